@@ -66,8 +66,7 @@ bool Analyser::Process(Block& block, Storage::Manager& manager, Deduper* deduper
   if ((block.data == nullptr) || (block.level >= Block::MAX_RECURSION_LEVEL))
     return false;
   Streams::HybridStream* hstream = reinterpret_cast<Streams::HybridStream*>(block.data);
-  Streams::FileStream* fstream;
-  if ((block.level > 0) && (!hstream->Active() && !block.Revive(manager)))
+  if ((block.level > 0) && (!hstream->Restored(block.offset, block.length) && !block.Revive(manager)))
     return false;
   if (deduper != nullptr)
     deduper->Process(block, nullptr, manager);
@@ -86,18 +85,14 @@ bool Analyser::Process(Block& block, Storage::Manager& manager, Deduper* deduper
         b = &block;
         if ((b->level != level) || b->done)
           b = b->Next(level);
+        // don't let the stream be purged from storage or put to sleep, until we move on to a block in another one
+        Streams::Lease lease;
         while (b != nullptr) {
           hstream = reinterpret_cast<Streams::HybridStream*>(b->data);
-          fstream = reinterpret_cast<Streams::FileStream*>(b->data);
-
-          if (level > 0) {
-            // attempt stream revival if needed
-            if (!hstream->Active() && !b->Revive(manager))
-              break;
-            else  // don't let it be purged from storage
-              hstream->keep_alive = true;
-          }
-          else if (!fstream->WakeUp())
+          if ((!lease) && !(lease = Streams::Lease(b->data)))
+            break;
+          // attempt stream revival if needed
+          if ((level > 0) && !hstream->Restored(b->offset, b->length) && !b->Revive(manager))
             break;
 
           // get pointer to current "next" block at this recursion level, since the segmentation may change that
@@ -117,12 +112,8 @@ bool Analyser::Process(Block& block, Storage::Manager& manager, Deduper* deduper
           if ((deduper != nullptr) && result.parser)
             deduper->Process(*b, next, manager);
 
-          if ((next == nullptr) || (next->data != b->data)) {
-            if (level > 0)
-              hstream->keep_alive = false;
-            else
-              fstream->Sleep();
-          }
+          if ((next == nullptr) || (next->data != b->data))
+            lease.Release();
           b = next;
         }
       }
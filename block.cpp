@@ -24,45 +24,41 @@
 bool Block::Revive(Storage::Manager& manager) {
   assert((data != nullptr) && (level > 0) && (parent != nullptr));
   Streams::HybridStream* stream = reinterpret_cast<Streams::HybridStream*>(data);
-  if (stream->Active())
+  Streams::Lease const lease(stream);
+  if (stream->Restored(offset, length))
     return true;
 
-  bool parent_was_dormant = false;
-  Streams::HybridStream* parent_hstream = reinterpret_cast<Streams::HybridStream*>(parent->data);
-  Streams::FileStream*   parent_fstream = reinterpret_cast<Streams::FileStream*>(parent->data);
-  // recreate parent stream, if needed
-  if (level > 1) {
-    if ((parent->data == nullptr) || (!parent_hstream->Active() && !parent->Revive(manager)))
-      return false;
-    // don't let it be purged
-    parent_hstream->keep_alive = true;
-  }
-  else {
-    parent_was_dormant = parent_fstream->Dormant();
-    if (parent_was_dormant && !parent_fstream->WakeUp())
-      return false;
-  }
+  // don't let the parent stream be purged or put to sleep while we use it, and recreate it if needed
+  Streams::Lease const parent_lease(parent->data);
+  if (!parent_lease)
+    return false;
+  if ((level > 1) && !parent->Revive(manager))
+    return false;
 
   bool result = false;
-  manager.Reallocate(*stream);
+  if (!stream->Active())
+    manager.Reallocate(*stream);
   // when parsing, we had enough storage for the parent stream and this stream.
   // however, when deduping, we might have to restore 2 blocks at once, so this may have failed
   if (stream->Active()) {
     std::unique_ptr<Transform> transform = TransformFactory::Create(parent->type);
     if (transform) {
-      parent->data->Seek(parent->offset);
-      result = transform->Apply(*parent->data, *stream, parent->info);
+      // recreate just this block if the transform can resume close to it, otherwise the whole stream
+      std::int64_t begin = offset, end = offset + length;
+      Streams::Slice input = parent->View();
+      result = transform->Resume(input, *stream, begin, end, parent->info);
+      if (!result) {
+        begin = 0, end = INT64_MAX;
+        input.Seek(0);
+        stream->Seek(0);
+        result = transform->Apply(input, *stream, parent->info);
+      }
       if (!result)
         // something went terribly wrong, panic
         throw std::logic_error("Failed to recover transformed stream");
-      stream->keep_alive = true;
+      stream->SetRestored(begin, end);
     }
   }
-  if (level > 1)
-    parent_hstream->keep_alive = false;
-  else if (parent_was_dormant)
-    parent_fstream->Sleep();
-
   return result;
 }
 
@@ -76,7 +72,7 @@ Block* Block::Segment(Block::Segmentation& segmentation) {
     block->next   = new_block;
     block->child  = nullptr;
     if (block->level > 0)
-      reinterpret_cast<Streams::HybridStream*>(block->data)->reference_count++;
+      reinterpret_cast<Streams::HybridStream*>(block->data)->AddReference();
     block->Hash();
     block = new_block;
   }
@@ -92,7 +88,7 @@ Block* Block::Segment(Block::Segmentation& segmentation) {
     new_block->child  = nullptr;
     new_block->level  = block->level;
     if (block->level > 0)
-      reinterpret_cast<Streams::HybridStream*>(block->data)->reference_count++;
+      reinterpret_cast<Streams::HybridStream*>(block->data)->AddReference();
   }
 
   block->type   = segmentation.type;
@@ -119,6 +115,13 @@ Block* Block::Segment(Block::Segmentation& segmentation) {
     }
     block->child->done = segmentation.child.done;
     block->child->Hash();
+    // reviving the child may require reviving this stream first
+    if (block->level > 0) {
+      Streams::HybridStream* child = reinterpret_cast<Streams::HybridStream*>(block->child->data);
+      std::int64_t const cost = reinterpret_cast<Streams::HybridStream*>(block->data)->revive_cost();
+      if ((cost != Streams::UNKNOWN_REVIVE_COST) && (child->revive_cost() != Streams::UNKNOWN_REVIVE_COST))
+        child->SetReviveCost(child->revive_cost() + cost);
+    }
   }
 
   return block->next;
@@ -144,6 +147,7 @@ void Block::DeleteInfo() {
     return;
   switch (type) {
     case Block::Type::Deflate: {
+      delete static_cast<Structures::DeflateInfo*>(info)->checkpoints;
       delete static_cast<Structures::DeflateInfo*>(info);
       info = nullptr;
       break;
@@ -23,6 +23,7 @@
 
 #include "common.hpp"
 #include "streams/stream.hpp"
+#include "streams/slice.hpp"
 #include "storage/manager.hpp"
 
 class Block {
@@ -71,6 +72,8 @@ public:
   void DeleteInfo();
   void DeleteChilds(Storage::Manager& manager);
   void Hash();
+  // the contents of this block, without moving the cursor of its stream
+  Streams::Slice View() const { return Streams::Slice(data, offset, length); }
 };
 
 #endif  // BLOCK_HPP
\ No newline at end of file
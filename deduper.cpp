@@ -23,77 +23,27 @@ bool Deduper::Match(Block& block0, Block& block1, Storage::Manager& manager) {
   // start by checking full hashes and lengths
   if ((&block0 == &block1) || (block0.type != block1.type) || (block0.hash != block1.hash) || (block0.length != block1.length))
     return false;
-  struct {
-    bool dormant;
-    Streams::HybridStream* hstream;
-    Streams::FileStream* fstream;
-  } blocks[2] {
-    {false, reinterpret_cast<Streams::HybridStream*>(block0.data), reinterpret_cast<Streams::FileStream*>(block0.data)},
-    {false, reinterpret_cast<Streams::HybridStream*>(block1.data), reinterpret_cast<Streams::FileStream*>(block1.data)}
-  };
-  // attempt to revive streams if needed
-  if (block0.level > 0) {
-    if ((block0.data == nullptr) || (!blocks[0].hstream->Active() && !block0.Revive(manager)))
-      return false;
-    blocks[0].hstream->keep_alive = true;
-  }
-  else {
-    blocks[0].dormant = blocks[0].fstream->Dormant();
-    if (blocks[0].dormant && !blocks[0].fstream->WakeUp())
-      return false;
-  }
-
-  if (block1.level > 0) {
-    if ((block1.data == nullptr) || (!blocks[1].hstream->Active() && !block1.Revive(manager))) {
-      if (block0.level > 0)
-        blocks[0].hstream->keep_alive = false;
-      return false;
-    }
-    blocks[1].hstream->keep_alive = true;
-  }
-  else {
-    blocks[1].dormant = blocks[1].fstream->Dormant();
-    if (blocks[1].dormant && !blocks[1].fstream->WakeUp()) {
-      if (block0.level > 0)
-        blocks[0].hstream->keep_alive = false;
-      else if (blocks[0].dormant)
-        blocks[0].fstream->Sleep();
-      return false;
-    }
-  }
+  // keep both streams available while comparing them, reviving them if needed
+  Streams::Lease const lease0(block0.data), lease1(block1.data);
+  if ((!lease0) || (!lease1))
+    return false;
+  if ((block0.level > 0) && !reinterpret_cast<Streams::HybridStream*>(block0.data)->Restored(block0.offset, block0.length) && !block0.Revive(manager))
+    return false;
+  if ((block1.level > 0) && !reinterpret_cast<Streams::HybridStream*>(block1.data)->Restored(block1.offset, block1.length) && !block1.Revive(manager))
+    return false;
   // now proceed to compare them
   bool result = true;
   std::int64_t length = block0.length;
-  std::int64_t offsets[2] { block0.offset, block1.offset };  // need to keep track of the offsets, because the blocks may share the same stream
-  try {
-    while ((length > 0) && result) {
-      std::size_t const size = static_cast<std::size_t>(std::min<std::int64_t>(Storage::BLOCK_SIZEi64, length));
-      block0.data->Seek(offsets[0]);
-      std::size_t const bytes_read = block0.data->Read(&buffer[0], size);
-      block1.data->Seek(offsets[1]);
-      result = (bytes_read > 0) && (bytes_read == block1.data->Read(&buffer[Storage::BLOCK_SIZE], size));
-      if (result) {
-        result = (std::memcmp(&buffer[0], &buffer[Storage::BLOCK_SIZE], size) == 0);
-        offsets[0] += bytes_read;
-        offsets[1] += bytes_read;
-        length -= static_cast<std::int64_t>(bytes_read);
-      }
+  Streams::Slice slice0 = block0.View(), slice1 = block1.View();  // each with its own cursor, since the blocks may share the same stream
+  while ((length > 0) && result) {
+    std::size_t const size = static_cast<std::size_t>(std::min<std::int64_t>(Storage::BLOCK_SIZEi64, length));
+    std::size_t const bytes_read = slice0.Read(&buffer[0], size);
+    result = (bytes_read > 0) && (bytes_read == slice1.Read(&buffer[Storage::BLOCK_SIZE], size));
+    if (result) {
+      result = (std::memcmp(&buffer[0], &buffer[Storage::BLOCK_SIZE], size) == 0);
+      length -= static_cast<std::int64_t>(bytes_read);
     }
   }
-  catch (Storage::Exhausted const&) {
-    result = false;
-  }
-  // clean up
-  if (block0.level > 0)
-    blocks[0].hstream->keep_alive = false;
-  else if (blocks[0].dormant)
-    blocks[0].fstream->Sleep();
-
-  if (block1.level > 0)
-    blocks[1].hstream->keep_alive = false;
-  else if (blocks[1].dormant)
-    blocks[1].fstream->Sleep();
-
   return result;
 }
 
@@ -117,14 +67,18 @@ void Deduper::Process(Block& start, Block* end, Storage::Manager& manager) {
         block->DeleteChilds(manager);
         if (block->level > 0) {
           Streams::HybridStream* stream = reinterpret_cast<Streams::HybridStream*>(block->data);
-          // free the stream if possible
+          // free the stream if possible, or at least its storage if it's still leased elsewhere,
+          // in which case it's deleted along with the other blocks
           if ((block->offset == 0) && (block->length == block->data->Size())) {
-            assert(stream->reference_count == 0);
-            manager.Delete(stream);
+            assert(stream->reference_count() == 0);
+            if (stream->leased())
+              manager.Deallocate(*stream);
+            else
+              manager.Delete(stream);
           }
           // otherwise just decrease its reference count
           else
-            stream->reference_count -= (stream->reference_count > 0);
+            stream->RemoveReference();
         }
         block->type = Block::Type::Dedup;
         // info now points to the block we deduplicated from
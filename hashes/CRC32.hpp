@@ -31,19 +31,15 @@ private:
 public:
   static std::uint32_t Process(Streams::Stream* stream, std::int64_t const offset, std::int64_t length) {
     std::uint32_t crc = 0xFFFFFFFFu;
-    try {
-      stream->Seek(offset);
-    }
-    catch (Storage::Exhausted const&) {
-      return ~crc;
-    }
     Storage::Buffer buffer;
+    std::int64_t position = offset;
     while (length > 0) {
-      std::size_t const bytes_read = stream->Read(&buffer[0], static_cast<std::size_t>(std::min<std::int64_t>(Storage::BLOCK_SIZEi64, length)));
+      std::size_t const bytes_read = stream->ReadAt(&buffer[0], static_cast<std::size_t>(std::min<std::int64_t>(Storage::BLOCK_SIZEi64, length)), position);
       if (bytes_read == 0)
         break;
       for (std::size_t i = 0; i < bytes_read; i++)
         crc = CRC32LUT[(crc ^ buffer[i]) & 0xFF] ^ (crc >> 8);
+      position += bytes_read;
       length -= bytes_read;
     }
     return ~crc;
@@ -0,0 +1,156 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef LZ_HPP
+#define LZ_HPP
+
+#include "../common.hpp"
+#ifndef MSC
+#  include <cstring>
+#endif
+
+namespace LZ {  // byte-aligned LZ77 codec for small blocks, built for speed rather than ratio
+  static constexpr std::size_t HASH_BITS = 12;
+  static constexpr std::size_t MIN_MATCH = 4;
+  static constexpr std::size_t WINDOW_SIZE = 0x10000;  // match offsets are stored in 16 bits
+
+  /*
+    The compressed data is a sequence of tokens, each followed by:
+    - the literal length excess (if the high nibble of the token is 15), as a run of bytes summed until one is below 255
+    - the literals
+    - the match offset, 16 bit little-endian, and the match length excess (if the low nibble of the token is 15)
+    The last token only has literals.
+  */
+
+  static inline std::uint32_t Hash(std::uint8_t const* p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ::HASH_BITS);
+  }
+
+  static inline std::uint8_t* PutLength(std::uint8_t* out, std::uint8_t const* const end, std::size_t length) {
+    for (; length >= 255; length -= 255) {
+      if (out >= end)
+        return nullptr;
+      *out++ = 255;
+    }
+    if (out >= end)
+      return nullptr;
+    *out++ = static_cast<std::uint8_t>(length);
+    return out;
+  }
+
+  static inline std::uint8_t* PutSequence(std::uint8_t* out, std::uint8_t const* const end, std::uint8_t const* literals, std::size_t const count, std::size_t const offset, std::size_t const length) {
+    if (out >= end)
+      return nullptr;
+    std::uint8_t* token = out++;
+    *token = static_cast<std::uint8_t>(std::min<std::size_t>(count, 15) << 4);
+    if ((count >= 15) && ((out = LZ::PutLength(out, end, count - 15)) == nullptr))
+      return nullptr;
+    if (count > static_cast<std::size_t>(end - out))
+      return nullptr;
+    std::memcpy(out, literals, count);
+    out += count;
+    if (length == 0)
+      return out;
+    if (end - out < 2)
+      return nullptr;
+    *out++ = static_cast<std::uint8_t>(offset & 0xFF);
+    *out++ = static_cast<std::uint8_t>(offset >> 8);
+    *token |= static_cast<std::uint8_t>(std::min<std::size_t>(length - LZ::MIN_MATCH, 15));
+    if (length - LZ::MIN_MATCH >= 15)
+      out = LZ::PutLength(out, end, length - LZ::MIN_MATCH - 15);
+    return out;
+  }
+
+  // compresses "length" bytes into at most "capacity" bytes, returns the compressed size or 0 if it didn't fit
+  static inline std::size_t Compress(std::uint8_t const* const in, std::size_t const length, std::uint8_t* const out, std::size_t const capacity) {
+    assert(length <= LZ::WINDOW_SIZE);
+    std::uint32_t table[1 << LZ::HASH_BITS] = {};  // most recent position + 1 for each hash
+    std::uint8_t* op = out;
+    std::uint8_t const* const end = out + capacity;
+    std::size_t i = 0, anchor = 0;
+    while (i + LZ::MIN_MATCH <= length) {
+      std::uint32_t const h = LZ::Hash(in + i);
+      std::size_t const candidate = table[h];
+      table[h] = static_cast<std::uint32_t>(i + 1);
+      if ((candidate > 0) && (i - (candidate - 1) < LZ::WINDOW_SIZE) && (std::memcmp(in + candidate - 1, in + i, LZ::MIN_MATCH) == 0)) {
+        std::size_t const match = candidate - 1;
+        std::size_t n = LZ::MIN_MATCH;
+        for (std::uint64_t a, b; (i + n + sizeof(a) <= length) && (std::memcpy(&a, in + match + n, sizeof(a)), std::memcpy(&b, in + i + n, sizeof(b)), a == b); n += sizeof(a));
+        for (; (i + n < length) && (in[match + n] == in[i + n]); n++);
+        if ((op = LZ::PutSequence(op, end, in + anchor, i - anchor, i - match, n)) == nullptr)
+          return 0;
+        i += n;
+        anchor = i;
+      }
+      else
+        i += 1 + ((i - anchor) >> 6);  // skip faster over incompressible data
+    }
+    if ((op = LZ::PutSequence(op, end, in + anchor, length - anchor, 0, 0)) == nullptr)
+      return 0;
+    return static_cast<std::size_t>(op - out);
+  }
+
+  // decompresses exactly "length" bytes, returns false if the data is malformed
+  static inline bool Decompress(std::uint8_t const* in, std::size_t const size, std::uint8_t* const out, std::size_t const length) {
+    std::uint8_t const* const in_end = in + size;
+    std::size_t n = 0;
+    while (in < in_end) {
+      std::uint8_t const token = *in++;
+      std::size_t count = token >> 4;
+      if (count == 15) {
+        std::uint8_t b;
+        do {
+          if (in >= in_end)
+            return false;
+          count += (b = *in++);
+        } while (b == 255);
+      }
+      if ((count > static_cast<std::size_t>(in_end - in)) || (count > length - n))
+        return false;
+      std::memcpy(out + n, in, count);
+      in += count, n += count;
+      if (in == in_end)
+        break;
+      if (in_end - in < 2)
+        return false;
+      std::size_t const offset = in[0] | (static_cast<std::size_t>(in[1]) << 8);
+      in += 2;
+      std::size_t match = (token & 0xF) + LZ::MIN_MATCH;
+      if ((token & 0xF) == 15) {
+        std::uint8_t b;
+        do {
+          if (in >= in_end)
+            return false;
+          match += (b = *in++);
+        } while (b == 255);
+      }
+      if ((offset == 0) || (offset > n) || (match > length - n))
+        return false;
+      // the source may overlap the destination, so copy forward one byte at a time
+      for (std::size_t i = 0; i < match; i++, n++)
+        out[n] = out[n - offset];
+    }
+    return n == length;
+  }
+}  // namespace LZ
+
+#endif  // LZ_HPP
@@ -34,6 +34,21 @@ namespace Misc {
     return x;
   }
 
+  // index of the lowest set bit, x must not be 0
+  inline std::uint32_t TrailingZeros(std::uint64_t const x) {
+    assert(x != 0);
+  #if defined(MSC) && defined(ARCH_X86_64)
+    DWORD tmp = 0;
+    BitScanForward64(&tmp, x);
+    return tmp;
+  #elif defined(GCC) || defined(CLANG)
+    return static_cast<std::uint32_t>(__builtin_ctzll(x));  // tzcnt, when BMI is available
+  #else
+    std::uint64_t const y = (x & (~x + 1)) - 1;  // isolate the lowest set bit and turn the bits below it on
+    return PopCount(static_cast<std::uint32_t>(y)) + PopCount(static_cast<std::uint32_t>(y >> 32));
+  #endif
+  }
+
   inline std::uint32_t IntLog2(std::uint32_t x) {
   #ifdef MSC
     DWORD tmp = 0;
@@ -45,11 +45,13 @@ bool BitmapParser::Parse(Block* block, Structures::ParsingData& data, Storage::M
   std::int64_t offset = 0;  // pixel data offset
   bool result = false, has_file_header = false, has_core_header = false;
   while (i < length) {
-    std::size_t j = 0, bytes_read = block->data->Read(&buffer[0], buffer.size());
+    Streams::PinnedSpan span;
+    std::uint8_t const* input = nullptr;
+    std::size_t j = 0, bytes_read = Fetch(block, span, input);
     while ((j < bytes_read) && (i < length)) {
       wnd[0] = (wnd[0] << 8) | (wnd[1] >> 56);
       wnd[1] = (wnd[1] << 8) | (wnd[2] >> 56);
-      wnd[2] = (wnd[2] << 8) | buffer[j++];
+      wnd[2] = (wnd[2] << 8) | input[j++];
       i++, position++;
       // Start of detection code
       headers.file.bfType = static_cast<std::uint16_t>(wnd[0] & 0xFFFF);
@@ -29,7 +29,6 @@ inline bool DeflateParser::Validate(std::int64_t const in, std::int64_t const ou
 
 void DeflateParser::ClearBuffers() {
   window.fill(0);
-  input_block.fill(0);
   output_block.fill(0);
   skip_positions.fill(false);
   histogram.fill(0);
@@ -73,51 +72,18 @@ void DeflateParser::PerformBruteModeSearch(bool& result) {
   }
 }
 
-void DeflateParser::GetStreamInfo(Block* block, Structures::DeflateInfo& info, bool const brute) {
-  int ret = Z_OK;
+// quick check for a possible stream by decompressing the first WINDOW_LOOKBACK bytes, its length is only found when attempting to transform it
+bool DeflateParser::Probe(Structures::DeflateInfo const& info, bool const brute) {
   z_stream stream;
   zLib::SetupStream(&stream);
-  // Quick check possible stream by decompressing first WINDOW_LOOKBACK bytes
-  if (zLib::InflateInit(&stream, info.zLib.parameters) == Z_OK) {
-    stream.next_in = &window[(wnd_position - (brute ? 0 : WINDOW_LOOKBACK)) & WINDOW_ACCESS_MASK];
-    stream.avail_in = WINDOW_LOOKBACK;
-    stream.next_out = &output_block[0];
-    stream.avail_out = static_cast<uInt>(zLib::BLOCK_SIZE);
-    ret = inflate(&stream, Z_FINISH);
-    ret = ((inflateEnd(&stream) == Z_OK) && ((ret == Z_STREAM_END) || (ret == Z_BUF_ERROR)) && (stream.total_in >= 16));
-  }
-  // Verify possible valid stream and determine its length
-  if (ret != 0) {
-    zLib::SetupStream(&stream);
-    stream.total_in = stream.total_out = 0u;
-    if (zLib::InflateInit(&stream, info.zLib.parameters) == Z_OK) {
-      if (!block->data->Seek(position - (brute ? BRUTE_LOOKBACKi64 : WINDOW_LOOKBACKi64)))
-        return;
-      std::size_t block_size = 0;
-      std::int64_t total_in = 0, total_out = 0;
-      do {
-        block_size = block->data->Read(&input_block[0], input_block.size());
-        stream.next_in = &input_block[0];
-        stream.avail_in = static_cast<uInt>(block_size);
-        do {
-          stream.next_out = &output_block[0];
-          stream.avail_out = static_cast<uInt>(zLib::BLOCK_SIZE);
-          ret = inflate(&stream, Z_FINISH);
-        } while ((stream.avail_out == 0) && (ret == Z_BUF_ERROR));
-        // update totals, taking care to handle 32-bit overflows
-        std::int64_t new_total = static_cast<std::int64_t>(stream.total_in), total_low = total_in & ULONG_MASK;
-        total_in += ((total_low <= new_total) ? new_total : 0x100000000LL + new_total) - total_low;
-        new_total = static_cast<std::int64_t>(stream.total_out), total_low = total_out & ULONG_MASK;
-        total_out += ((total_low <= new_total) ? new_total : 0x100000000LL + new_total) - total_low;
-        if ((ret == Z_STREAM_END) && Validate(total_in, total_out, brute))
-          info.compressed_length = total_in, info.uncompressed_length = total_out;
-        if (ret != Z_BUF_ERROR)
-          break;
-      } while (block_size > 0);
-      if (inflateEnd(&stream) != Z_OK)
-        info.compressed_length = info.uncompressed_length = 0;
-    }
-  }
+  if (zLib::InflateInit(&stream, info.zLib.parameters) != Z_OK)
+    return false;
+  stream.next_in = &window[(wnd_position - (brute ? 0 : WINDOW_LOOKBACK)) & WINDOW_ACCESS_MASK];
+  stream.avail_in = WINDOW_LOOKBACK;
+  stream.next_out = &output_block[0];
+  stream.avail_out = static_cast<uInt>(zLib::BLOCK_SIZE);
+  int const ret = inflate(&stream, Z_FINISH);
+  return (inflateEnd(&stream) == Z_OK) && ((ret == Z_STREAM_END) || (ret == Z_BUF_ERROR)) && (stream.total_in >= 16);
 }
 
 DeflateParser::DeflateParser(const std::shared_ptr<void>& options) : configuration{} {
@@ -146,9 +112,11 @@ bool DeflateParser::Parse(Block* block, Structures::ParsingData& data, Storage::
   bool result = false;
   ClearBuffers();
   while (i < length) {
-    std::size_t j = 0, bytes_read = block->data->Read(&buffer[0], buffer.size());
+    Streams::PinnedSpan span;
+    std::uint8_t const* input = nullptr;
+    std::size_t j = 0, bytes_read = Fetch(block, span, input);
     while ((j < bytes_read) && (i < length)) {
-      ProcessByte(buffer[j++]);
+      ProcessByte(input[j++]);
       index++, i++, position++;
       // Start of generic detection code
       data.deflate.zLib.parameters = zLib::ParseHeader( (ReadBack(0) << 8) | ReadBack(1) );
@@ -159,17 +127,25 @@ bool DeflateParser::Parse(Block* block, Structures::ParsingData& data, Storage::
         PerformBruteModeSearch(valid);
       bool const brute = (data.deflate.zLib.parameters == -1) && (configuration.parse_zip_streams && (index != zip_offset)) && (configuration.parse_gzip_streams && (index != gzip.offset));
 
+      bool candidate = false;
       if (valid || (configuration.parse_zip_streams && (zip_offset > 0) && (index == zip_offset)) || (configuration.parse_gzip_streams && (gzip.offset > 0) && (index == gzip.offset))) {
         skip_positions[(wnd_position - WINDOW_LOOKBACK) & WINDOW_ACCESS_MASK] = !brute;
-        GetStreamInfo(block, data.deflate, brute);
+        candidate = Probe(data.deflate, brute);
       }
 
-      if (data.deflate.compressed_length > 0) {  // we have a valid stream
+      if (candidate) {  // we may have a valid stream
         std::int64_t offset = position - (brute ? BRUTE_LOOKBACKi64 : WINDOW_LOOKBACKi64);  // actual initial stream offset
-        if (!block->data->Seek(offset))
+        if (offset < 0)
           break;
 
-        Streams::HybridStream* output = transform.Attempt(*block->data, manager, &data.deflate);
+        // the stream ends somewhere in the rest of the block, and its length is found while attempting to transform it
+        Streams::Slice input(block->data, offset, block->offset + block->length - offset);
+        Streams::HybridStream* output = transform.Attempt(input, manager, &data.deflate);
+        bool const found = (data.deflate.compressed_length > 0) && (data.deflate.zLib.combination < zLib::POSSIBLE_COMBINATIONS) && Validate(data.deflate.compressed_length, data.deflate.uncompressed_length, brute);
+        if ((output != nullptr) && (!found)) {
+          manager.Delete(output);
+          output = nullptr;
+        }
         if (output != nullptr) {
           Block::Segmentation segmentation{};
           segmentation.offset = offset;
@@ -180,13 +156,13 @@ bool DeflateParser::Parse(Block* block, Structures::ParsingData& data, Storage::
           segmentation.child.stream = output;
           block = block->Segment(segmentation);
 
-          output->priority = Streams::Priority::High;
+          output->SetPriority(Streams::Priority::High);
           result = true;
           if (block == nullptr)
             return result;
         }
         // we succeeded, or it was a valid stream but we didn't have enough storage budget for it, so skip it anyway
-        if ((output != nullptr) || (data.deflate.zLib.combination < zLib::POSSIBLE_COMBINATIONS)) {
+        if (found) {
           index = 0;
           i += data.deflate.compressed_length - (brute ? BRUTE_LOOKBACKi64 : WINDOW_LOOKBACKi64);
           position = offset + data.deflate.compressed_length;
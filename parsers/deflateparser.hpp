@@ -48,7 +48,6 @@ private:
   static constexpr std::size_t  BRUTE_ROUNDS = BRUTE_LOOKBACK >> 6;
   DeflateTransform transform;
   std::array<std::uint8_t, WINDOW_SIZE> window;
-  std::array<std::uint8_t, zLib::BLOCK_SIZE> input_block;
   std::array<std::uint8_t, zLib::BLOCK_SIZE> output_block;
   std::array<bool, BRUTE_LOOKBACK> skip_positions;
   std::array<int, 256> histogram;
@@ -69,7 +68,7 @@ private:
   void ClearBuffers();
   void ProcessByte(std::uint8_t const b);
   void PerformBruteModeSearch(bool& result);
-  void GetStreamInfo(Block* block, Structures::DeflateInfo& info, bool const brute);
+  bool Probe(Structures::DeflateInfo const& info, bool const brute);
 public:
   enum Options {
     UseBruteMode = 1,
@@ -43,9 +43,11 @@ bool JpegParser::Parse(Block* block, Structures::ParsingData& data, Storage::Man
   bool result = false;
   std::uint32_t previous_4_bytes = 0;
   while (i < length) {
-    std::size_t j = 0, bytes_read = block->data->Read(&buffer[0], buffer.size());
+    Streams::PinnedSpan span;
+    std::uint8_t const* input = nullptr;
+    std::size_t j = 0, bytes_read = Fetch(block, span, input);
     while ((j < bytes_read) && (i < length)) {
-      std::uint8_t c = buffer[j++];
+      std::uint8_t c = input[j++];
       previous_4_bytes = (previous_4_bytes << 8) | c;
       i++, position++;
       // Start of detection code
@@ -60,7 +62,7 @@ bool JpegParser::Parse(Block* block, Structures::ParsingData& data, Storage::Man
         std::int64_t start = position, offset = start - 2;
         // process markers
         do {
-          if (!block->data->Seek(offset) || (block->data->Read(&buffer[0], 5) != 5) || (buffer[0] != 0xFF))
+          if ((block->data->ReadAt(&buffer[0], 5, offset) != 5) || (buffer[0] != 0xFF))
             break;
 
           std::int64_t marker_length = static_cast<std::int64_t>(buffer[2]) * 256 + static_cast<std::int64_t>(buffer[3]);
@@ -118,7 +120,7 @@ bool JpegParser::Parse(Block* block, Structures::ParsingData& data, Storage::Man
           offset += 5;
           bool is_marker = (buffer[4] == 0xFF);
           do {
-            bytes_read = block->data->Read(&buffer[0], buffer.size());
+            bytes_read = block->data->ReadAt(&buffer[0], buffer.size(), offset);
 
             for (std::size_t k = 0; !done && (k < bytes_read); k++) {
               c = buffer[k];
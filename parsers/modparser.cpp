@@ -41,9 +41,11 @@ bool ModParser::Parse(Block* block, Structures::ParsingData& data, Storage::Mana
   std::uint32_t wnd32[2] = {};
   bool result = false;
   while (i < length) {
-    std::size_t j = 0, bytes_read = block->data->Read(&buffer[0], buffer.size());
+    Streams::PinnedSpan span;
+    std::uint8_t const* input = nullptr;
+    std::size_t j = 0, bytes_read = Fetch(block, span, input);
     while ((j < bytes_read) && (i < length)) {
-      std::uint8_t const c = buffer[j++];
+      std::uint8_t const c = input[j++];
       wnd32[1] = (wnd32[1] << 8) | (wnd32[0] >> 24);
       wnd32[0] = (wnd32[0] << 8) | c;
       wnd.Add(c);
@@ -41,6 +41,7 @@ namespace Parsers {
     Fuzzy
   };
   static constexpr Types All[] = { Types::Strict, Types::Fuzzy };
+  static constexpr std::int64_t MAX_SPAN_SIZE = Storage::BLOCK_SIZEi64 * 16;  // maximum size of the chunks scanned in-place
 
 #define PARSER_ROW(a,b) a,
   enum class Names {
@@ -68,6 +69,16 @@ class Parser {
 protected:
   Storage::Buffer buffer;
   std::int64_t position;
+  // get the next chunk of data at the current position, scanning it in place when it's pinned in memory
+  std::size_t Fetch(Block* block, Streams::PinnedSpan& span, std::uint8_t const*& data) {
+    span = block->data->Pin(position, static_cast<std::size_t>(std::min<std::int64_t>(block->offset + block->length - position, Parsers::MAX_SPAN_SIZE)));
+    if (span) {
+      data = span.data();
+      return span.size();
+    }
+    data = &buffer[0];
+    return block->data->ReadAt(&buffer[0], buffer.size(), position);
+  }
 public:
   int priority;
   virtual bool Parse(Block* block, Structures::ParsingData& data, Storage::Manager& manager) = 0;
@@ -0,0 +1,176 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "compressedcontainer.hpp"
+#include "../misc/lz.hpp"
+
+namespace Storage {
+
+  // blocks that don't compress to less than this are stored as they are
+  static constexpr std::size_t MAX_COMPRESSED_BLOCK = Storage::BLOCK_SIZE - Storage::BLOCK_SIZE / 8;
+
+  CompressedContainer::CompressedContainer(std::int64_t const size) :
+    Container(std::max<std::int64_t>(Storage::RoundToBlockMultiple(size), Storage::BLOCK_SIZEi64) * CompressedContainer::MAX_RATIO),
+    budget(size),
+    used(0),
+    cached(-1),
+    dirty(false)
+  {
+    slots.resize(static_cast<std::size_t>(capacity_ / Storage::BLOCK_SIZEi64));
+  }
+
+  bool CompressedContainer::Store(Storage::CompressedContainer::Slot& slot, std::uint8_t const* data) {
+    std::array<std::uint8_t, Storage::MAX_COMPRESSED_BLOCK> buffer;
+    std::size_t size = LZ::Compress(data, Storage::BLOCK_SIZE, buffer.data(), buffer.size());
+    if (size > 0)
+      data = buffer.data();
+    else
+      size = Storage::BLOCK_SIZE;
+    std::unique_ptr<std::uint8_t[]> payload;
+    try {
+      payload = std::unique_ptr<std::uint8_t[]>(new std::uint8_t[size]);
+    }
+    catch (...) { return false; }
+    std::memcpy(payload.get(), data, size);
+    used += static_cast<std::int64_t>(size) - static_cast<std::int64_t>(slot.data ? slot.size : 0);
+    slot.data = std::move(payload);
+    slot.size = static_cast<std::uint16_t>(size);
+    return true;
+  }
+
+  bool CompressedContainer::Load(std::int64_t const offset) {
+    assert((offset & Storage::BLOCK_MASKi64) == 0);
+    if (offset == cached)
+      return true;
+    if (!Flush())
+      return false;
+    Storage::CompressedContainer::Slot const& slot = slots[static_cast<std::size_t>(offset / Storage::BLOCK_SIZEi64)];
+    assert(slot.data);
+    if (slot.size == Storage::BLOCK_SIZE)
+      std::memcpy(cache.data(), slot.data.get(), Storage::BLOCK_SIZE);
+    else if (!LZ::Decompress(slot.data.get(), slot.size, cache.data(), Storage::BLOCK_SIZE)) {
+      cached = -1;
+      return false;
+    }
+    cached = offset;
+    return true;
+  }
+
+  bool CompressedContainer::Flush() {
+    // the budget is only enforced when claiming, since modified data can't just be dropped
+    if (dirty && Store(slots[static_cast<std::size_t>(cached / Storage::BLOCK_SIZEi64)], cache.data()))
+      dirty = false;
+    return !dirty;  // on failure, the block stays cached
+  }
+
+  bool CompressedContainer::Claim(Storage::Arena& arena, Storage::MemoryContainer& memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::int64_t size = 0;
+    for (auto const& extent : arena.extents) {
+      if (extent.type == Storage::Type::Memory)
+        size += extent.length;
+    }
+    if ((size > available_) || (size == 0) || (used >= budget))
+      return size == 0;
+
+    // compress everything first, giving up as soon as it won't fit or isn't worth it
+    std::vector<Storage::CompressedContainer::Slot> claimed(static_cast<std::size_t>(size / Storage::BLOCK_SIZEi64));
+    std::int64_t const before = used, limit = std::min<std::int64_t>(budget - used, size - size / 4);
+    std::size_t i = 0;
+    for (auto const& extent : arena.extents) {
+      if (extent.type != Storage::Type::Memory)
+        continue;
+      for (std::int64_t offset = extent.offset; offset < extent.offset + extent.length; offset += Storage::BLOCK_SIZEi64, i++) {
+        if ((!Store(claimed[i], memory.Data(offset))) || (used - before > limit)) {
+          if (used - before > limit)
+            arena.incompressible = (used - before) > size - size / 4;
+          used = before;
+          return false;
+        }
+      }
+    }
+
+    Storage::Arena target;
+    if (!Allocate(size, target)) {
+      used = before;
+      return false;
+    }
+    i = 0;
+    for (auto const& extent : target.extents) {
+      for (std::int64_t offset = extent.offset; offset < extent.offset + extent.length; offset += Storage::BLOCK_SIZEi64, i++)
+        slots[static_cast<std::size_t>(offset / Storage::BLOCK_SIZEi64)] = std::move(claimed[i]);
+    }
+    // the memory storage replaced is left for the caller to release
+    Storage::Replace(arena, Storage::Type::Memory, target);
+    return true;
+  }
+
+  void CompressedContainer::Deallocate(Storage::Arena& arena) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto const& extent : arena.extents) {
+      if (extent.type != Storage::Type::Compressed)
+        continue;
+      for (std::int64_t offset = extent.offset; offset < extent.offset + extent.length; offset += Storage::BLOCK_SIZEi64) {
+        Storage::CompressedContainer::Slot& slot = slots[static_cast<std::size_t>(offset / Storage::BLOCK_SIZEi64)];
+        used -= slot.size;
+        slot.data.reset();
+        slot.size = 0;
+        if (offset == cached)
+          cached = -1, dirty = false;
+      }
+    }
+    Container::Deallocate(arena);
+  }
+
+  bool CompressedContainer::Read(std::int64_t offset, void* buf, std::size_t count) {
+    assert((offset >= 0) && (offset + static_cast<std::int64_t>(count) <= capacity_));
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uint8_t* data = static_cast<std::uint8_t*>(buf);
+    while (count > 0) {
+      std::size_t const index = static_cast<std::size_t>(offset & Storage::BLOCK_MASKi64);
+      std::size_t const length = std::min<std::size_t>(Storage::BLOCK_SIZE - index, count);
+      if (!Load(offset - static_cast<std::int64_t>(index)))
+        return false;
+      std::memcpy(data, &cache[index], length);
+      data += length;
+      offset += static_cast<std::int64_t>(length);
+      count -= length;
+    }
+    return true;
+  }
+
+  bool CompressedContainer::Write(std::int64_t offset, void const* buf, std::size_t count) {
+    assert((offset >= 0) && (offset + static_cast<std::int64_t>(count) <= capacity_));
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uint8_t const* data = static_cast<std::uint8_t const*>(buf);
+    while (count > 0) {
+      std::size_t const index = static_cast<std::size_t>(offset & Storage::BLOCK_MASKi64);
+      std::size_t const length = std::min<std::size_t>(Storage::BLOCK_SIZE - index, count);
+      if (!Load(offset - static_cast<std::int64_t>(index)))
+        return false;
+      std::memcpy(&cache[index], data, length);
+      dirty = true;
+      data += length;
+      offset += static_cast<std::int64_t>(length);
+      count -= length;
+    }
+    return true;
+  }
+
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef COMPRESSEDCONTAINER_HPP
+#define COMPRESSEDCONTAINER_HPP
+
+#include "container.hpp"
+#include "memorycontainer.hpp"
+
+namespace Storage {
+
+  // Keeps blocks compressed in memory, within a budget. Offsets are logical, one block per slot.
+  class CompressedContainer final : public Container<Storage::Type::Compressed> {
+  private:
+    static constexpr std::int64_t MAX_RATIO = 8;  // number of slots per block of budget
+    typedef struct Slot {
+      std::unique_ptr<std::uint8_t[]> data;
+      std::uint16_t size;  // size of the compressed data, or BLOCK_SIZE if stored uncompressed
+    } Slot;
+    std::vector<Storage::CompressedContainer::Slot> slots;
+    std::int64_t const budget;  // maximum memory used by compressed data
+    std::int64_t used;
+    Storage::Buffer cache;  // decompressed contents of the last block accessed
+    std::int64_t cached;  // offset of the cached block, or -1
+    bool dirty;  // set if the cached block must be compressed again
+    std::mutex mutex;  // guards the slots and the cache
+    bool Store(Storage::CompressedContainer::Slot& slot, std::uint8_t const* data);
+    bool Load(std::int64_t const offset);
+    bool Flush();
+  public:
+    CompressedContainer(std::int64_t const size);
+    bool Claim(Storage::Arena& arena, Storage::MemoryContainer& memory);
+    void Deallocate(Storage::Arena& arena);
+    bool Read(std::int64_t offset, void* buf, std::size_t count);
+    bool Write(std::int64_t offset, void const* buf, std::size_t count);
+  };
+
+}  // namespace Storage
+
+#endif  // COMPRESSEDCONTAINER_HPP
@@ -22,64 +22,182 @@
 #define CONTAINER_HPP
 
 #include "storage.hpp"
+#include "../misc/misc.hpp"
+#include <mutex>
 
 namespace Storage {
 
-  template<Storage::Type type, template <typename...> class Map>
+  static constexpr std::size_t SHARD_BLOCKS = 4096;  // blocks in each independently locked part of a container (16 MB)
+
+  // shard where the calling thread starts its searches, so that threads allocating at the same time rarely contend for it
+  inline std::size_t HomeShard() {
+    static std::atomic<std::size_t> threads{ 0 };
+    thread_local std::size_t const shard = threads.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+  }
+
+  template<Storage::Type type>
   class Container: public Storage::Holder {
   protected:
-    std::vector<Storage::Block> blocks;
-    Map<std::int64_t, Storage::Block*> free;
-    Map<std::int64_t, Storage::Block*> used;
+    static constexpr std::size_t BITS = 64;
+    static_assert((Storage::SHARD_BLOCKS % Container::BITS) == 0, "Shards must cover whole bitmap words");
+    // each shard of the bitmap has its own lock and its own hint of where its free blocks start
+    typedef struct Shard {
+      std::mutex mutex;
+      std::size_t lowest;  // index of the first bitmap word in this shard that may have free blocks
+    } Shard;
+    std::vector<std::uint64_t> bitmap;  // one bit per block, set if the block is free
+    std::size_t blocks;  // number of blocks in this container
+    std::unique_ptr<Shard[]> shards;
+    std::size_t shard_count;
+
+    // index of the block past the last one in the given shard
+    std::size_t End(std::size_t const shard) const {
+      return std::min<std::size_t>((shard + 1) * Storage::SHARD_BLOCKS, blocks);
+    }
+    // index of the first free block at or after "from", not searching past "limit"
+    std::size_t FindFree(std::size_t const from, std::size_t const limit) const {
+      if (from >= limit)
+        return limit;
+      std::size_t i = from / Container::BITS;
+      std::uint64_t word = bitmap[i] & (~0ULL << (from % Container::BITS));
+      while (word == 0) {
+        if ((++i >= bitmap.size()) || (i * Container::BITS >= limit))
+          return limit;
+        word = bitmap[i];
+      }
+      return std::min<std::size_t>(i * Container::BITS + Misc::TrailingZeros(word), limit);
+    }
+    // index of the first used block at or after "from", not searching past "limit"
+    std::size_t FindUsed(std::size_t const from, std::size_t const limit) const {
+      std::size_t i = from / Container::BITS;
+      std::uint64_t word = ~bitmap[i] & (~0ULL << (from % Container::BITS));
+      while (word == 0) {
+        if ((++i >= bitmap.size()) || (i * Container::BITS >= limit))
+          return std::min<std::size_t>(limit, blocks);
+        word = ~bitmap[i];
+      }
+      return std::min<std::size_t>(std::min<std::size_t>(i * Container::BITS + Misc::TrailingZeros(word), limit), blocks);
+    }
+    void Mark(std::size_t first, std::size_t const last, bool const available) {
+      while (first < last) {
+        std::size_t const i = first / Container::BITS, shift = first % Container::BITS;
+        std::size_t const count = std::min<std::size_t>(Container::BITS - shift, last - first);
+        std::uint64_t const mask = ((count == Container::BITS) ? ~0ULL : ((1ULL << count) - 1)) << shift;
+        if (available)
+          bitmap[i] |= mask;
+        else
+          bitmap[i] &= ~mask;
+        first += count;
+      }
+    }
+    void Take(std::size_t const first, std::size_t const count, Storage::Arena& arena) {
+      Mark(first, first + count, false);
+      Storage::Append(arena, { type, static_cast<std::int64_t>(first) * Storage::BLOCK_SIZEi64, static_cast<std::int64_t>(count) * Storage::BLOCK_SIZEi64 });
+    }
+    // first-fit search for a single run of free blocks in a shard, must be called with its lock held
+    bool Fit(std::size_t const shard, std::size_t const needed, Storage::Arena& arena) {
+      std::size_t const start = shards[shard].lowest * Container::BITS, end = End(shard);
+      std::size_t const lowest = FindFree(start, end);
+      for (std::size_t i = lowest, j; i < end; i = FindFree(j, end)) {
+        j = FindUsed(i, std::min<std::size_t>(i + needed, end));
+        if (j - i == needed) {
+          Take(i, needed, arena);
+          // taking the lowest free run moves the hint past it
+          if (i == lowest)
+            shards[shard].lowest = FindFree(i, end) / Container::BITS;
+          return true;
+        }
+      }
+      return false;
+    }
+    // takes the free runs of a shard in address order, up to the given number of blocks, must be called with its lock held
+    std::size_t Gather(std::size_t const shard, std::size_t const needed, Storage::Arena& arena) {
+      std::size_t const start = shards[shard].lowest * Container::BITS, end = End(shard);
+      std::size_t taken = 0;
+      for (std::size_t i = FindFree(start, end), j; (taken < needed) && (i < end); i = FindFree(j, end)) {
+        j = FindUsed(i, std::min<std::size_t>(i + needed - taken, end));
+        Take(i, j - i, arena);
+        taken += j - i;
+      }
+      shards[shard].lowest = FindFree(start, end) / Container::BITS;
+      return taken;
+    }
   public:
     Container(std::int64_t size) {
       size = RoundToBlockMultiple(size);
       if (size < Storage::BLOCK_SIZEi64)
         throw Storage::Exhausted();
-      std::size_t const n = static_cast<std::size_t>(size / Storage::BLOCK_SIZEi64);
-      blocks.resize(n);
-      capacity_ = 0;
-      for (std::size_t i=0; i<n; i++, capacity_ += Storage::BLOCK_SIZEi64) {
-        blocks[i].type = type;
-        blocks[i].offset = capacity_;
-        free[capacity_] = &blocks[i];
-      }
-      available_ = capacity_;
+      blocks = static_cast<std::size_t>(size / Storage::BLOCK_SIZEi64);
+      bitmap.resize((blocks + Container::BITS - 1) / Container::BITS, ~0ULL);
+      if ((blocks % Container::BITS) != 0)
+        bitmap.back() = (1ULL << (blocks % Container::BITS)) - 1;  // blocks past the end are never free
+      shard_count = (blocks + Storage::SHARD_BLOCKS - 1) / Storage::SHARD_BLOCKS;
+      shards.reset(new Shard[shard_count]);
+      for (std::size_t i = 0; i < shard_count; i++)
+        shards[i].lowest = i * (Storage::SHARD_BLOCKS / Container::BITS);
+      capacity_ = available_ = size;
     }
     virtual ~Container() = default;
     Container(const Container&) = delete;
     Container& operator=(const Container&) = delete;
     Container(Container&&) = delete;
     Container& operator=(Container&&) = delete;
-    void Allocate(std::int64_t const size, Storage::Arena& arena) {
+    // returns false, leaving the arena untouched, if there isn't enough storage available
+    bool Allocate(std::int64_t const size, Storage::Arena& arena) {
       assert((size & Storage::BLOCK_MASKi64) == 0);
-      if (size > available_)
-        throw Exhausted();
-      std::size_t const n = static_cast<std::size_t>(size / Storage::BLOCK_SIZEi64);
-      assert(n <= free.size());
-      arena.blocks.reserve(arena.blocks.size() + n);
-      auto iter = free.begin();
-      for (std::size_t i=0; i<n; i++) {
-        Storage::Block* b = iter->second;  // get free block
-        used[b->offset] = b;               // add it to the used map
-        iter = free.erase(iter);           // remove it from the free map
-        arena.blocks.emplace_back(b);      // append it to the arena
+      // claim the storage up front, after which enough free blocks are sure to turn up
+      std::int64_t expected = available_.load(std::memory_order_relaxed);
+      do {
+        if (size > expected)
+          return false;
+      } while (!available_.compare_exchange_weak(expected, expected - size));
+      std::size_t needed = static_cast<std::size_t>(size / Storage::BLOCK_SIZEi64);
+      if (needed == 0)
+        return true;
+      // requests that fit in a shard start at the one for this thread, larger ones at the start of the container
+      std::size_t const home = (needed <= Storage::SHARD_BLOCKS) ? Storage::HomeShard() % shard_count : 0;
+      if (needed <= Storage::SHARD_BLOCKS) {
+        for (std::size_t k = 0; k < shard_count; k++) {
+          std::size_t const shard = (home + k) % shard_count;
+          std::lock_guard<std::mutex> lock(shards[shard].mutex);
+          if (Fit(shard, needed, arena))
+            return true;
+        }
       }
-      available_ -= size;
+      // free space is too fragmented, so take the free runs in address order, going around until all were found,
+      // since blocks freed by other threads may only turn up in shards already visited
+      for (std::size_t k = 0; needed > 0; k++) {
+        std::size_t const shard = (home + k) % shard_count;
+        std::lock_guard<std::mutex> lock(shards[shard].mutex);
+        needed -= Gather(shard, needed, arena);
+      }
+      return true;
     }
     void Deallocate(Storage::Arena& arena, bool const erase = false) {
-      for (auto b : arena.blocks) {
-        if (b->type == type) {
-          free[b->offset] = b;                   // add it to the free map
-          used.erase(b->offset);                 // remove it from the used map
-          available_ += Storage::BLOCK_SIZEi64;  // reclaim available storage
+      for (auto const& extent : arena.extents) {
+        if (extent.type == type) {
+          std::size_t first = static_cast<std::size_t>(extent.offset / Storage::BLOCK_SIZEi64);
+          std::size_t const last = first + static_cast<std::size_t>(extent.length / Storage::BLOCK_SIZEi64);
+          while (first < last) {
+            std::size_t const shard = first / Storage::SHARD_BLOCKS, end = std::min<std::size_t>(last, End(shard));
+            std::lock_guard<std::mutex> lock(shards[shard].mutex);
+            Mark(first, end, true);  // mark the blocks as free
+            shards[shard].lowest = std::min<std::size_t>(shards[shard].lowest, first / Container::BITS);
+            first = end;
+          }
+          available_ += extent.length;  // reclaim available storage, only once the blocks can be found
         }
       }
-      if (erase)
-        arena.blocks.erase(std::remove_if(arena.blocks.begin(), arena.blocks.end(), [](Block const* b) { return b->type == type; }), arena.blocks.end());
+      if (erase) {
+        arena.extents.erase(std::remove_if(arena.extents.begin(), arena.extents.end(), [&arena](Extent const& e) {
+          if (e.type != type)
+            return false;
+          arena.size -= e.length;
+          return true;
+        }), arena.extents.end());
+      }
     }
-    virtual bool Read(Storage::Block& block, Storage::Buffer& buf) = 0;
-    virtual bool Write(Storage::Block& block, Storage::Buffer& buf) = 0;
   };
 
 }  // namespace Storage
@@ -21,82 +21,168 @@
 
 namespace Storage {
 
-  DiskContainer::DiskContainer(std::int64_t size) : Container(size) {
-    // get temporary physical storage
-    file = GetTempFile(size);
+  DiskContainer::DiskContainer(std::int64_t size, std::vector<std::string> const& directories, bool const direct) : Container(size) {
+    // the files start out empty, and only grow as storage is allocated
+    try {
+      std::size_t const count = std::max<std::size_t>(directories.size(), 1);
+      files.reserve(count);
+      for (std::size_t i = 0; i < count; i++) {
+        Storage::Expected<int> descriptor = Storage::GetTempFile(directories.empty() ? std::string() : directories[i]);
+        if (!descriptor)
+          throw Storage::Exhausted();
+        files.push_back({ *descriptor, 0, nullptr });
+        files.back().engine.reset(new Storage::IOEngine());
+      }
+      // in direct mode, spilled blocks don't also take up space in the OS cache
+      for (std::size_t i = 0; i < count; i++)
+        files[i].engine->Open(files[i].descriptor, PhysicalSize(i, capacity_), direct && Storage::BypassCache(files[i].descriptor));
+    }
+    catch (...) {
+      Close();
+      throw Storage::Exhausted();
+    }
   }
 
   DiskContainer::~DiskContainer() {
-    fclose(file);
+    Close();
+  }
+
+  void DiskContainer::Close() {
+    for (auto& file : files) {
+      if (file.engine != nullptr)
+        file.engine->Close();
+      Storage::CloseTempFile(file.descriptor);
+    }
+    files.clear();
+  }
+
+  std::size_t DiskContainer::Map(std::int64_t const offset, std::int64_t& physical, std::int64_t& left) const {
+    std::int64_t const stripe = offset / Storage::DiskContainer::STRIPE_SIZE, n = static_cast<std::int64_t>(files.size());
+    physical = (stripe / n) * Storage::DiskContainer::STRIPE_SIZE + (offset % Storage::DiskContainer::STRIPE_SIZE);
+    left = Storage::DiskContainer::STRIPE_SIZE - (offset % Storage::DiskContainer::STRIPE_SIZE);
+    return static_cast<std::size_t>(stripe % n);
+  }
+
+  // how large a file must be to hold its share of all storage below the given offset
+  std::int64_t DiskContainer::PhysicalSize(std::size_t const file, std::int64_t const end) const {
+    std::int64_t const stripes = end / Storage::DiskContainer::STRIPE_SIZE, n = static_cast<std::int64_t>(files.size()), i = static_cast<std::int64_t>(file);
+    std::int64_t size = ((stripes + n - 1 - i) / n) * Storage::DiskContainer::STRIPE_SIZE;
+    if ((stripes % n) == i)
+      size += end % Storage::DiskContainer::STRIPE_SIZE;
+    return size;
+  }
+
+  bool DiskContainer::Reserve(Storage::Arena const& arena) {
+    std::int64_t end = 0;
+    for (auto const& extent : arena.extents)
+      end = std::max<std::int64_t>(end, extent.offset + extent.length);
+    std::lock_guard<std::mutex> lock(growth);
+    for (std::size_t i = 0; i < files.size(); i++) {
+      std::int64_t const needed = PhysicalSize(i, end);
+      if (needed <= files[i].size)
+        continue;
+      std::int64_t const size = std::min<std::int64_t>(PhysicalSize(i, capacity_), (needed + Storage::DiskContainer::GROWTH_SIZE - 1) / Storage::DiskContainer::GROWTH_SIZE * Storage::DiskContainer::GROWTH_SIZE);
+      if (!Storage::Grow(files[i].descriptor, files[i].size, size))
+        return false;
+      files[i].size = size;
+    }
+    return true;
+  }
+
+  bool DiskContainer::Allocate(std::int64_t const size, Storage::Arena& arena) {
+    // take the blocks on the side, so they can be given back if the files can't grow to hold them
+    Storage::Arena added;
+    if (!Container::Allocate(size, added))
+      return false;
+    if (!Reserve(added)) {
+      Container::Deallocate(added);
+      return false;
+    }
+    for (auto const& extent : added.extents)
+      Storage::Append(arena, extent);
+    return true;
   }
 
   bool DiskContainer::Claim(Storage::Arena& arena, Storage::MemoryContainer& memory) {
-    // count how many blocks need to be replaced
-    std::size_t const n = std::count_if(arena.blocks.begin(), arena.blocks.end(), [](Storage::Block const* b) { return b->type != Storage::Type::Disk; });
-    if (((static_cast<std::int64_t>(n) * Storage::BLOCK_SIZEi64) > available_) || (n == 0))
-      return n == 0;
-
-    Storage::Buffer buf{};
-    std::size_t const length = arena.blocks.size();
-    auto iter = free.begin();
-    bool ok = true;
-    arena.blocks.reserve(length + n);
-    for (std::size_t i=0; ok && (i<length); i++) {
-      Storage::Block* block = arena.blocks[i];
-      if (block->type != Storage::Type::Disk) {
-        try {
-          ok = memory.Read(*block, buf);     // read the block data
-          if (!ok)
-            break;
-          Storage::Block* b = iter->second;  // get free block
-          ok = Write(*b, buf);               // write the data to it
-          if (!ok)
-            break;
-          used[b->offset] = b;               // add it to the used map
-          iter = free.erase(iter);           // remove it from the free map
-          arena.blocks.emplace_back(b);      // append it to the arena
-        }
-        catch (...) { ok = false; };
-      }
+    // count how much storage needs to be replaced, compressed storage stays where it is
+    std::int64_t size = 0;
+    for (auto const& extent : arena.extents) {
+      if (extent.type == Storage::Type::Memory)
+        size += extent.length;
     }
-    if (ok) {
-      memory.Deallocate(arena);  // can't remove the memory blocks just yet
-      for (std::size_t i=0, j=length, k=arena.blocks.size(); (i<length) && (j<k); i++) {
-        // replace every memory block with the corresponding disk block
-        if (arena.blocks[i]->type != Storage::Type::Disk) {
-          assert(arena.blocks[j]->type == Storage::Type::Disk);
-          arena.blocks[i] = arena.blocks[j];
-          available_ -= Storage::BLOCK_SIZEi64;
-          j++;
+    if ((size > available_) || (size == 0))
+      return size == 0;
+
+    Storage::Arena target;
+    if (!Allocate(size, target))
+      return false;
+    // queue each stripe of the target extents for writing with as few requests as possible, splitting the source extents as needed
+    bool ok = true;
+    std::array<Storage::Span, DiskContainer::MAX_SPANS> spans;
+    auto source = arena.extents.begin();
+    std::int64_t consumed = 0;  // bytes of the current source extent already written
+    for (auto const& extent : target.extents) {
+      for (std::int64_t done = 0; ok && (done < extent.length);) {
+        std::int64_t physical, left;
+        std::size_t const file = Map(extent.offset + done, physical, left);
+        std::int64_t const limit = std::min<std::int64_t>(extent.length - done, left);
+        std::size_t count = 0;
+        std::int64_t length = 0;
+        while ((count < DiskContainer::MAX_SPANS) && (length < limit)) {
+          while (source->type != Storage::Type::Memory)
+            source++;
+          std::int64_t const bytes = std::min<std::int64_t>(source->length - consumed, limit - length);
+          spans[count++] = { memory.Data(source->offset + consumed), static_cast<std::size_t>(bytes) };
+          length += bytes;
+          if ((consumed += bytes) == source->length) {
+            source++;
+            consumed = 0;
+          }
         }
+        ok = files[file].engine->Submit(physical, spans.data(), count);
+        done += length;
       }
     }
-    else {  // failed to commit all blocks to disk, must undo changes
-      for (std::size_t i=length; i<arena.blocks.size(); i++) {
-        Storage::Block* b = arena.blocks[i];
-        assert(b->type == Storage::Type::Disk);
-        free[b->offset] = b;
-        used.erase(b->offset);
-      }
+    if (!ok) {  // failed to commit everything to disk, must undo changes
+      Deallocate(target);
+      return false;
     }
-    // resize and trim
-    arena.blocks.erase(arena.blocks.begin() + length, arena.blocks.end());
-    arena.blocks.shrink_to_fit();
-    return ok;
+
+    // the memory storage replaced is left for the caller to release
+    Storage::Replace(arena, Storage::Type::Memory, target);
+    return true;
   }
 
-  bool DiskContainer::Read(Storage::Block& block, Storage::Buffer& buf) {
-    assert(block.type == Storage::Type::Disk);
-    if (fseeko(file, block.offset, SEEK_SET) != 0)
-      return false;
-    return std::fread(buf.data(), 1, buf.size(), file) == buf.size();
+  bool DiskContainer::Read(std::int64_t offset, void* buf, std::size_t count) {
+    std::uint8_t* data = static_cast<std::uint8_t*>(buf);
+    // split the request at stripe boundaries
+    while (count > 0) {
+      std::int64_t physical, left;
+      std::size_t const file = Map(offset, physical, left);
+      std::size_t const bytes = static_cast<std::size_t>(std::min<std::int64_t>(left, static_cast<std::int64_t>(count)));
+      if (!files[file].engine->Read(physical, data, bytes))
+        return false;
+      data += bytes;
+      offset += static_cast<std::int64_t>(bytes);
+      count -= bytes;
+    }
+    return true;
   }
 
-  bool DiskContainer::Write(Storage::Block& block, Storage::Buffer& buf) {
-    assert(block.type == Storage::Type::Disk);
-    if (fseeko(file, block.offset, SEEK_SET) != 0)
-      return false;
-    return std::fwrite(buf.data(), 1, buf.size(), file) == buf.size();
+  bool DiskContainer::Write(std::int64_t offset, void const* buf, std::size_t count) {
+    std::uint8_t const* data = static_cast<std::uint8_t const*>(buf);
+    // split the request at stripe boundaries
+    while (count > 0) {
+      std::int64_t physical, left;
+      std::size_t const file = Map(offset, physical, left);
+      std::size_t const bytes = static_cast<std::size_t>(std::min<std::int64_t>(left, static_cast<std::int64_t>(count)));
+      if (!files[file].engine->Write(physical, data, bytes))
+        return false;
+      data += bytes;
+      offset += static_cast<std::int64_t>(bytes);
+      count -= bytes;
+    }
+    return true;
   }
 
 }
\ No newline at end of file
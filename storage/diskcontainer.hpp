@@ -23,19 +23,33 @@
 
 #include "container.hpp"
 #include "memorycontainer.hpp"
-#include <map>
+#include "ioengine.hpp"
 
 namespace Storage {
 
-  class DiskContainer final : public Container<Storage::Type::Disk, std::map> {
+  class DiskContainer final : public Container<Storage::Type::Disk> {
   private:
-    std::FILE* file;
+    static constexpr std::size_t MAX_SPANS = 64;  // maximum number of spans queued for writing in a single request
+    static constexpr std::int64_t STRIPE_SIZE = 256 * Storage::BLOCK_SIZEi64;  // storage is striped across the files in units of this size
+    static constexpr std::int64_t GROWTH_SIZE = 64 * Storage::DiskContainer::STRIPE_SIZE;  // files grow in increments of this size
+    typedef struct File {
+      int descriptor;
+      std::int64_t size;  // physical storage currently reserved
+      std::unique_ptr<Storage::IOEngine> engine;  // background write-behind and read-ahead
+    } File;
+    std::vector<Storage::DiskContainer::File> files;  // one per spill directory
+    std::mutex growth;  // guards the sizes of the files
+    std::size_t Map(std::int64_t const offset, std::int64_t& physical, std::int64_t& left) const;
+    std::int64_t PhysicalSize(std::size_t const file, std::int64_t const end) const;
+    bool Reserve(Storage::Arena const& arena);
+    void Close();
   public:
-    DiskContainer(std::int64_t size);
+    DiskContainer(std::int64_t size, std::vector<std::string> const& directories = std::vector<std::string>(), bool const direct = false);
     ~DiskContainer();
+    bool Allocate(std::int64_t const size, Storage::Arena& arena);
     bool Claim(Storage::Arena& arena, Storage::MemoryContainer& memory);
-    bool Read(Storage::Block& block, Storage::Buffer& buf);
-    bool Write(Storage::Block& block, Storage::Buffer& buf);
+    bool Read(std::int64_t offset, void* buf, std::size_t count);
+    bool Write(std::int64_t offset, void const* buf, std::size_t count);
   };
 
 }  // namespace Storage
@@ -0,0 +1,352 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ioengine.hpp"
+#include <cerrno>
+
+namespace Storage {
+
+  static inline bool Overlap(std::int64_t const a, std::int64_t const a_length, std::int64_t const b, std::int64_t const b_length) {
+    return (a < b + b_length) && (b < a + a_length);
+  }
+
+  static inline bool Inside(std::int64_t const a, std::int64_t const a_length, std::int64_t const b, std::int64_t const b_length) {
+    return (a >= b) && (a + a_length <= b + b_length);
+  }
+
+  bool IOEngine::Read(int const descriptor, std::int64_t offset, void* buf, std::size_t count) {
+    std::uint8_t* data = static_cast<std::uint8_t*>(buf);
+    while (count > 0) {
+#ifdef WINDOWS
+      OVERLAPPED overlapped{};
+      overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFLL);
+      overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD bytes = 0;
+      if (!ReadFile(reinterpret_cast<HANDLE>(_get_osfhandle(descriptor)), data, static_cast<DWORD>(std::min<std::size_t>(count, 0x40000000u)), &bytes, &overlapped) || (bytes == 0))
+        return false;
+#else
+      ssize_t const bytes = pread(descriptor, data, count, static_cast<off_t>(offset));
+      if (bytes < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      else if (bytes == 0)
+        return false;
+#endif
+      data += bytes;
+      offset += static_cast<std::int64_t>(bytes);
+      count -= static_cast<std::size_t>(bytes);
+    }
+    return true;
+  }
+
+  bool IOEngine::Write(int const descriptor, std::int64_t offset, void const* buf, std::size_t count) {
+    std::uint8_t const* data = static_cast<std::uint8_t const*>(buf);
+    while (count > 0) {
+#ifdef WINDOWS
+      OVERLAPPED overlapped{};
+      overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFFLL);
+      overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+      DWORD bytes = 0;
+      if (!WriteFile(reinterpret_cast<HANDLE>(_get_osfhandle(descriptor)), data, static_cast<DWORD>(std::min<std::size_t>(count, 0x40000000u)), &bytes, &overlapped) || (bytes == 0))
+        return false;
+#else
+      ssize_t const bytes = pwrite(descriptor, data, count, static_cast<off_t>(offset));
+      if (bytes < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      else if (bytes == 0)
+        return false;
+#endif
+      data += bytes;
+      offset += static_cast<std::int64_t>(bytes);
+      count -= static_cast<std::size_t>(bytes);
+    }
+    return true;
+  }
+
+  static inline bool Aligned(std::int64_t const offset, void const* buf, std::size_t const count) {
+    return ((offset & Storage::BLOCK_MASKi64) == 0) && ((count & Storage::BLOCK_MASK) == 0) && ((reinterpret_cast<std::uintptr_t>(buf) & Storage::BLOCK_MASK) == 0);
+  }
+
+  // unaligned requests go through a bounce buffer holding whole blocks
+  bool IOEngine::ReadDirect(std::int64_t offset, void* buf, std::size_t count) {
+    if (Aligned(offset, buf, count))
+      return IOEngine::Read(descriptor, offset, buf, count);
+    std::uint8_t* data = static_cast<std::uint8_t*>(buf);
+    Storage::AlignedBuffer bounce;
+    try {
+      bounce.resize(std::min<std::size_t>(Storage::WRITE_BEHIND_CHUNK, static_cast<std::size_t>(RoundToBlockMultiple(offset + static_cast<std::int64_t>(count)) - (offset & ~Storage::BLOCK_MASKi64))));
+    }
+    catch (...) { return false; }
+    while (count > 0) {
+      std::int64_t const start = offset & ~Storage::BLOCK_MASKi64;
+      std::size_t const skip = static_cast<std::size_t>(offset - start);
+      std::size_t const bytes = std::min<std::size_t>(count, bounce.size() - skip);
+      if (!IOEngine::Read(descriptor, start, bounce.data(), static_cast<std::size_t>(RoundToBlockMultiple(static_cast<std::int64_t>(skip + bytes)))))
+        return false;
+      std::memcpy(data, &bounce[skip], bytes);
+      data += bytes;
+      offset += static_cast<std::int64_t>(bytes);
+      count -= bytes;
+    }
+    return true;
+  }
+
+  // unaligned requests must read back the blocks they only partially overwrite
+  bool IOEngine::WriteDirect(std::int64_t offset, void const* buf, std::size_t count) {
+    if (Aligned(offset, buf, count))
+      return IOEngine::Write(descriptor, offset, buf, count);
+    std::uint8_t const* data = static_cast<std::uint8_t const*>(buf);
+    Storage::AlignedBuffer bounce;
+    try {
+      bounce.resize(std::min<std::size_t>(Storage::WRITE_BEHIND_CHUNK, static_cast<std::size_t>(RoundToBlockMultiple(offset + static_cast<std::int64_t>(count)) - (offset & ~Storage::BLOCK_MASKi64))));
+    }
+    catch (...) { return false; }
+    while (count > 0) {
+      std::int64_t const start = offset & ~Storage::BLOCK_MASKi64;
+      std::size_t const skip = static_cast<std::size_t>(offset - start);
+      std::size_t const bytes = std::min<std::size_t>(count, bounce.size() - skip);
+      std::size_t const length = static_cast<std::size_t>(RoundToBlockMultiple(static_cast<std::int64_t>(skip + bytes)));
+      if ((skip > 0) && !IOEngine::Read(descriptor, start, bounce.data(), Storage::BLOCK_SIZE))
+        return false;
+      if ((((skip + bytes) & Storage::BLOCK_MASK) != 0) && ((skip == 0) || (length > Storage::BLOCK_SIZE))) {
+        if (!IOEngine::Read(descriptor, start + static_cast<std::int64_t>(length - Storage::BLOCK_SIZE), &bounce[length - Storage::BLOCK_SIZE], Storage::BLOCK_SIZE))
+          return false;
+      }
+      std::memcpy(&bounce[skip], data, bytes);
+      if (!IOEngine::Write(descriptor, start, bounce.data(), length))
+        return false;
+      data += bytes;
+      offset += static_cast<std::int64_t>(bytes);
+      count -= bytes;
+    }
+    return true;
+  }
+
+  IOEngine::~IOEngine() {
+    Close();
+  }
+
+  void IOEngine::Open(int const descriptor, std::int64_t const capacity, bool const direct) {
+    assert(!worker.joinable());
+    this->descriptor = descriptor;
+    this->capacity = capacity;
+    this->direct = direct;
+    stop = false;
+    worker = std::thread(&IOEngine::Run, this);
+  }
+
+  void IOEngine::Close() {
+    if (!worker.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+    }
+    signal.notify_all();
+    worker.join();
+    // whatever is still queued is of no use to anyone now
+    queue.clear();
+    queued = 0;
+  }
+
+  // must be called with the lock held
+  bool IOEngine::Pending(std::int64_t const offset, std::size_t const count) const {
+    for (auto const& request : queue) {
+      if ((request.job == Storage::IOEngine::Job::Write) && Overlap(request.offset, static_cast<std::int64_t>(request.data.size()), offset, static_cast<std::int64_t>(count)))
+        return true;
+    }
+    return Writing(offset, count);
+  }
+
+  // must be called with the lock held
+  bool IOEngine::Writing(std::int64_t const offset, std::size_t const count) const {
+    for (auto const& r : writing) {
+      if (Overlap(r.offset, r.length, offset, static_cast<std::int64_t>(count)))
+        return true;
+    }
+    return false;
+  }
+
+  // must be called with the lock held
+  void IOEngine::Invalidate(std::int64_t const offset, std::size_t const count) {
+    std::int64_t const length = static_cast<std::int64_t>(count);
+    if (Overlap(ahead.offset, static_cast<std::int64_t>(ahead.data.size()), offset, length))
+      ahead.data.clear();
+    for (auto& request : queue) {
+      if ((request.job == Storage::IOEngine::Job::ReadAhead) && Overlap(request.offset, static_cast<std::int64_t>(request.data.size()), offset, length))
+        request.stale = true;
+    }
+    // data lost in failed writes is no longer needed once it has been overwritten
+    lost.erase(std::remove_if(lost.begin(), lost.end(), [offset, length](Range const& r) { return Inside(r.offset, r.length, offset, length); }), lost.end());
+  }
+
+  void IOEngine::Run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      signal.wait(lock, [this]() { return stop || !queue.empty(); });
+      if (stop)
+        break;
+      // only this thread removes requests, so the front one stays put while the lock is released
+      Storage::IOEngine::Request& request = queue.front();
+      lock.unlock();
+      bool const ok = (request.job == Storage::IOEngine::Job::Write) ?
+        IOEngine::Write(descriptor, request.offset, request.data.data(), request.data.size()) :
+        IOEngine::Read(descriptor, request.offset, request.data.data(), request.data.size());
+      lock.lock();
+      if (request.job == Storage::IOEngine::Job::Write) {
+        queued -= request.data.size();
+        if (!ok)
+          lost.push_back({ request.offset, static_cast<std::int64_t>(request.data.size()) });
+      }
+      else if (ok && !request.stale)
+        ahead = std::move(request);
+      queue.pop_front();
+      signal.notify_all();
+    }
+  }
+
+  bool IOEngine::Read(std::int64_t const offset, void* buf, std::size_t const count) {
+    assert((offset >= 0) && (offset + static_cast<std::int64_t>(count) <= capacity));
+    std::int64_t const length = static_cast<std::int64_t>(count);
+    std::unique_lock<std::mutex> lock(mutex);
+    bool done = false;
+    // the most recent pending write to this range holds the current data, if it covers all of it
+    for (auto request = queue.rbegin(); request != queue.rend(); request++) {
+      if ((request->job == Storage::IOEngine::Job::Write) && Overlap(request->offset, static_cast<std::int64_t>(request->data.size()), offset, length)) {
+        if (Inside(offset, length, request->offset, static_cast<std::int64_t>(request->data.size()))) {
+          std::memcpy(buf, &request->data[static_cast<std::size_t>(offset - request->offset)], count);
+          done = true;
+        }
+        break;
+      }
+    }
+    if (!done) {
+      signal.wait(lock, [this, offset, count]() { return !Pending(offset, count); });
+      // wait for an in-flight read-ahead that would give us this range
+      signal.wait(lock, [this, offset, length]() {
+        for (auto const& request : queue) {
+          if ((request.job == Storage::IOEngine::Job::ReadAhead) && !request.stale && Inside(offset, length, request.offset, static_cast<std::int64_t>(request.data.size())))
+            return false;
+        }
+        return true;
+      });
+      for (auto const& r : lost) {
+        if (Overlap(r.offset, r.length, offset, length))
+          return false;
+      }
+      if ((!ahead.data.empty()) && Inside(offset, length, ahead.offset, static_cast<std::int64_t>(ahead.data.size()))) {
+        std::memcpy(buf, &ahead.data[static_cast<std::size_t>(offset - ahead.offset)], count);
+        done = true;
+      }
+    }
+    // on sequential access, make sure the read-ahead window extends at least halfway past this read
+    std::int64_t const next = offset + length;
+    if ((offset == sequential) && (next < capacity)) {
+      std::int64_t end = ((!ahead.data.empty()) && (ahead.offset <= next)) ? ahead.offset + static_cast<std::int64_t>(ahead.data.size()) : next;
+      for (auto const& request : queue) {
+        if ((request.job == Storage::IOEngine::Job::ReadAhead) && (request.offset <= next))
+          end = std::max<std::int64_t>(end, request.offset + static_cast<std::int64_t>(request.data.size()));
+      }
+      std::int64_t const start = direct ? (next & ~Storage::BLOCK_MASKi64) : next;
+      std::size_t const size = static_cast<std::size_t>(std::min<std::int64_t>(capacity - start, static_cast<std::int64_t>(Storage::READ_AHEAD_SIZE)));
+      // but never over a range being written synchronously, since it could load the old contents
+      if ((end - next < static_cast<std::int64_t>(Storage::READ_AHEAD_SIZE / 2)) && (!Writing(start, size))) {
+        try {
+          queue.push_back({ Storage::IOEngine::Job::ReadAhead, start, Storage::AlignedBuffer(size), false });
+          signal.notify_all();
+        }
+        catch (...) {}  // read-ahead is only a hint
+      }
+    }
+    sequential = next;
+    if (done)
+      return true;
+    lock.unlock();
+    return direct ? ReadDirect(offset, buf, count) : IOEngine::Read(descriptor, offset, buf, count);
+  }
+
+  bool IOEngine::Write(std::int64_t const offset, void const* buf, std::size_t const count) {
+    assert((offset >= 0) && (offset + static_cast<std::int64_t>(count) <= capacity));
+    std::int64_t const start = direct ? (offset & ~Storage::BLOCK_MASKi64) : offset;
+    std::size_t const length = direct ? static_cast<std::size_t>(RoundToBlockMultiple(offset + static_cast<std::int64_t>(count)) - start) : count;
+    std::unique_lock<std::mutex> lock(mutex);
+    // queued writes to this range must land first, including to the rest of any block that will be read back
+    signal.wait(lock, [this, start, length]() { return !Pending(start, length); });
+    Invalidate(offset, count);
+    // until it's done, reads of the range wait for it, and no read-ahead is scheduled over it
+    try {
+      writing.push_back({ start, static_cast<std::int64_t>(length) });
+    }
+    catch (...) { return false; }
+    lock.unlock();
+    bool const ok = direct ? WriteDirect(offset, buf, count) : IOEngine::Write(descriptor, offset, buf, count);
+    lock.lock();
+    // overlapping writes wait for each other, so the start identifies the range
+    writing.erase(std::find_if(writing.begin(), writing.end(), [start](Range const& r) { return r.offset == start; }));
+    signal.notify_all();
+    return ok;
+  }
+
+  bool IOEngine::Submit(std::int64_t offset, Storage::Span const* spans, std::size_t const count) {
+    // split the data into chunks of bounded size, copied into staging buffers and written in the background
+    for (std::size_t i = 0, skip = 0; i < count;) {
+      std::size_t length = 0;
+      for (std::size_t j = i, k = skip; (j < count) && (length < Storage::WRITE_BEHIND_CHUNK); j++, k = 0)
+        length += std::min<std::size_t>(spans[j].size - k, Storage::WRITE_BEHIND_CHUNK - length);
+      assert((offset >= 0) && (offset + static_cast<std::int64_t>(length) <= capacity));
+      Storage::AlignedBuffer data;
+      try {
+        data.resize(length);
+      }
+      catch (...) {}
+      std::uint8_t* staging = data.data();
+      for (std::size_t n = 0; n < length; ) {
+        std::size_t const bytes = std::min<std::size_t>(spans[i].size - skip, length - n);
+        if (data.empty()) {  // no memory for staging, so write it now
+          if (!Write(offset + static_cast<std::int64_t>(n), spans[i].data + skip, bytes))
+            return false;
+        }
+        else
+          std::memcpy(staging + n, spans[i].data + skip, bytes);
+        n += bytes;
+        if ((skip += bytes) == spans[i].size) {
+          i++;
+          skip = 0;
+        }
+      }
+      if (!data.empty()) {
+        std::unique_lock<std::mutex> lock(mutex);
+        // a background write must not race with a synchronous one to the same range
+        signal.wait(lock, [this, offset, length]() { return ((queued == 0) || (queued + length <= Storage::WRITE_BEHIND_SIZE)) && (!Writing(offset, length)); });
+        Invalidate(offset, length);
+        queue.push_back({ Storage::IOEngine::Job::Write, offset, std::move(data), false });
+        queued += length;
+        signal.notify_all();
+      }
+      offset += static_cast<std::int64_t>(length);
+    }
+    return true;
+  }
+
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef IOENGINE_HPP
+#define IOENGINE_HPP
+
+#include "storage.hpp"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace Storage {
+
+  static constexpr std::size_t READ_AHEAD_SIZE = 64 * Storage::BLOCK_SIZE;  // size of the sequential read-ahead window
+  static constexpr std::size_t WRITE_BEHIND_CHUNK = 256 * Storage::BLOCK_SIZE;  // maximum size of a single queued write
+  static constexpr std::size_t WRITE_BEHIND_SIZE = 16 * Storage::WRITE_BEHIND_CHUNK;  // maximum amount of queued writes
+
+  // An IOEngine performs positional I/O on a file, with write-behind and sequential read-ahead done by a background thread
+  class IOEngine {
+  private:
+    enum class Job { Write, ReadAhead };
+    typedef struct Request {
+      Storage::IOEngine::Job job;
+      std::int64_t offset;
+      Storage::AlignedBuffer data;
+      bool stale;  // for read-aheads, set if the range was written to after the request was queued
+    } Request;
+    typedef struct Range {
+      std::int64_t offset;
+      std::int64_t length;
+    } Range;
+    int descriptor = -1;
+    std::int64_t capacity = 0;
+    bool direct = false;  // set if the file bypasses the OS cache, so all I/O on it must be block aligned
+    std::deque<Storage::IOEngine::Request> queue;  // pending requests, the front one may be in progress
+    std::size_t queued = 0;  // bytes of pending writes
+    Storage::IOEngine::Request ahead{};  // last completed read-ahead
+    std::int64_t sequential = -1;  // where the next read must start for the access to be considered sequential
+    std::vector<Storage::IOEngine::Range> lost;  // ranges whose background writes failed
+    std::vector<Storage::IOEngine::Range> writing;  // ranges being written synchronously, outside of the queue
+    std::mutex mutex;
+    std::condition_variable signal;
+    std::thread worker;
+    bool stop = false;
+    bool Pending(std::int64_t const offset, std::size_t const count) const;
+    bool Writing(std::int64_t const offset, std::size_t const count) const;
+    void Invalidate(std::int64_t const offset, std::size_t const count);
+    void Run();
+    bool ReadDirect(std::int64_t offset, void* buf, std::size_t count);
+    bool WriteDirect(std::int64_t offset, void const* buf, std::size_t count);
+  public:
+    static bool Read(int const descriptor, std::int64_t offset, void* buf, std::size_t count);
+    static bool Write(int const descriptor, std::int64_t offset, void const* buf, std::size_t count);
+    IOEngine() = default;
+    ~IOEngine();
+    IOEngine(const IOEngine&) = delete;
+    IOEngine& operator=(const IOEngine&) = delete;
+    IOEngine(IOEngine&&) = delete;
+    IOEngine& operator=(IOEngine&&) = delete;
+    void Open(int const descriptor, std::int64_t const capacity, bool const direct = false);
+    void Close();
+    bool Read(std::int64_t const offset, void* buf, std::size_t const count);
+    bool Write(std::int64_t const offset, void const* buf, std::size_t const count);
+    bool Submit(std::int64_t offset, Storage::Span const* spans, std::size_t const count);
+  };
+
+}  // namespace Storage
+
+#endif  // IOENGINE_HPP
@@ -22,91 +22,354 @@
 
 namespace Storage {
 
-  void Manager::Purge(std::int64_t const request) {
-    std::vector<std::pair<std::int64_t, Streams::HybridStream*>> vect;
-    vect.reserve(streams.size());
-    for (auto stream : streams) {
-      if (stream->keep_alive || (!stream->Active()))
+  Manager::Shard& Manager::Locate(Streams::HybridStream const* stream) {
+    return registry[(reinterpret_cast<std::uintptr_t>(stream) / sizeof(Streams::HybridStream)) % Storage::Manager::REGISTRY_SHARDS];
+  }
+
+  bool Manager::Registered(Streams::HybridStream* stream) {
+    Storage::Manager::Shard& shard = Locate(stream);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.streams.find(stream) != shard.streams.end();
+  }
+
+  void Manager::SiftUp(std::vector<Streams::HybridStream*>& heap, std::size_t i) {
+    Streams::HybridStream* const stream = heap[i];
+    for (std::size_t parent; (i > 0) && (heap[parent = (i - 1) / 2]->cost < stream->cost); i = parent) {
+      heap[i] = heap[parent];
+      heap[i]->index = i;
+    }
+    heap[i] = stream;
+    stream->index = i;
+  }
+
+  void Manager::SiftDown(std::vector<Streams::HybridStream*>& heap, std::size_t i) {
+    Streams::HybridStream* const stream = heap[i];
+    for (std::size_t child; (child = 2 * i + 1) < heap.size(); i = child) {
+      if ((child + 1 < heap.size()) && (heap[child + 1]->cost > heap[child]->cost))
+        child++;
+      if (heap[child]->cost <= stream->cost)
+        break;
+      heap[i] = heap[child];
+      heap[i]->index = i;
+    }
+    heap[i] = stream;
+    stream->index = i;
+  }
+
+  void Manager::Remove(Streams::HybridStream& stream) {
+    std::size_t const i = stream.index;
+    if (i == Streams::HybridStream::NOT_INDEXED)
+      return;
+    std::vector<Streams::HybridStream*>& heap = heaps[stream.heap];
+    stream.index = Streams::HybridStream::NOT_INDEXED;
+    Streams::HybridStream* const last = heap.back();
+    heap.pop_back();
+    if (last != &stream) {
+      heap[i] = last;
+      SiftUp(heap, i);
+      SiftDown(heap, last->index);
+    }
+  }
+
+  void Manager::Update(Streams::HybridStream& stream) {
+    std::int64_t const hot = pool->Resident(*stream.arena, Storage::Type::Memory);
+    std::size_t const heap = ((hot > 0) ? Storage::Manager::Heap::Hot : Storage::Manager::Heap::Cold) * Storage::Policy::MAX_QUEUES + policy->Queue(stream);
+    // only streams holding storage that counts towards our capacity are worth purging
+    bool const candidate = (stream.leases_ == 0) && stream.Active() && ((hot > 0) || (pool->Resident(*stream.arena, Storage::Type::Disk) > 0));
+    if ((!candidate) || (heap != stream.heap))
+      Remove(stream);
+    if (!candidate)
+      return;
+    stream.cost = policy->Cost(stream);
+    stream.heap = heap;
+    if (stream.index == Streams::HybridStream::NOT_INDEXED) {
+      heaps[heap].push_back(&stream);
+      SiftUp(heaps[heap], heaps[heap].size() - 1);
+    }
+    else {
+      SiftUp(heaps[heap], stream.index);
+      SiftDown(heaps[heap], stream.index);
+    }
+  }
+
+  // entry point for streams, the ones above must be called with the lock held
+  void Manager::Notify(Streams::HybridStream& stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Update(stream);
+  }
+
+  // takes the first lease of a stream, which is about to be used and can't be purged meanwhile
+  void Manager::Access(Streams::HybridStream& stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // another thread may have leased it while we waited for the lock
+    if (stream.leases_++ > 0)
+      return;
+    statistics_.accesses++;
+    // a discarded stream is leased before being revived, and the policy only hears of it once it's readmitted
+    if (!stream.Active())
+      return;
+    policy->Access(stream);
+    Update(stream);
+    Promote(stream);
+  }
+
+  void Manager::Discard(Streams::HybridStream& stream) {
+    if (stream.Active())
+      policy->Evict(stream);
+    stream.Close();
+  }
+
+  Streams::HybridStream* Manager::Victim(bool const hot_only) {
+    for (;;) {
+      std::array<bool, Storage::Policy::MAX_QUEUES> candidates{};
+      for (std::size_t i = 0; i < Storage::Policy::MAX_QUEUES; i++)
+        candidates[i] = (!heaps[Storage::Manager::Heap::Hot * Storage::Policy::MAX_QUEUES + i].empty()) || ((!hot_only) && (!heaps[Storage::Manager::Heap::Cold * Storage::Policy::MAX_QUEUES + i].empty()));
+      if (std::none_of(candidates.begin(), candidates.end(), [](bool const c) { return c; }))
+        return nullptr;
+      std::size_t const queue = policy->Select(candidates);
+      std::vector<Streams::HybridStream*> const& hot = heaps[Storage::Manager::Heap::Hot * Storage::Policy::MAX_QUEUES + queue];
+      std::vector<Streams::HybridStream*> const& cold = heaps[Storage::Manager::Heap::Cold * Storage::Policy::MAX_QUEUES + queue];
+      Streams::HybridStream* const stream = (hot_only || cold.empty() || ((!hot.empty()) && (hot.front()->cost >= cold.front()->cost))) ? hot.front() : cold.front();
+      // leased streams are never purged, even if they're still waiting to be taken out of the heaps
+      if (stream->leases_ == 0)
+        return stream;
+      Remove(*stream);
+    }
+  }
+
+  // makes room for a request, with the given amount of it in hot storage
+  void Manager::Purge(std::int64_t const request, std::int64_t const hot) {
+    // streams are cheap if reviving them costs less than writing their hot storage to cold storage and reading it back
+    auto const cheap = [this](Streams::HybridStream const& stream) {
+      return (stream.revive_cost_ != Streams::UNKNOWN_REVIVE_COST) && (stream.revive_cost_ <= pool->Resident(*stream.arena, Storage::Type::Memory) * Storage::Manager::SPILL_COST);
+    };
+    std::vector<Streams::HybridStream*> demoted;
+    // first make room in hot storage by discarding cheap streams and keeping the others around, compressed or in cold storage,
+    // so streams whose revive cost is unknown are never discarded here
+    Streams::HybridStream* stream;
+    while ((pool->hot_available() < hot) && (hot <= pool->hot_capacity()) && (pool->available() >= request) && ((stream = Victim(true)) != nullptr)) {
+      Remove(*stream);
+      demoted.push_back(stream);
+      if (cheap(*stream)) {
+        Discard(*stream);
+        statistics_.discards++;
+      }
+      else if (stream->Compress() || stream->CommitToDisk())
+        statistics_.demotions++;
+      else
+        break;  // no room left in cold storage
+    }
+    for (auto s : demoted)
+      Update(*s);
+    // if there's still not enough storage, discard streams, whichever storage they're using, cheap ones first
+    // and those whose revive cost is unknown last, as if they were the most expensive
+    std::vector<Streams::HybridStream*> spared;
+    while ((pool->available() < request) && ((stream = Victim(false)) != nullptr)) {
+      Remove(*stream);
+      // compressing a stream keeps it alive, so only discard it if that fails
+      if (stream->Compress())
+        statistics_.demotions++;
+      else if (cheap(*stream)) {
+        Discard(*stream);
+        statistics_.discards++;
+      }
+      else {
+        spared.push_back(stream);
         continue;
-      std::int64_t const cost = (stream->capacity() / std::max<std::int64_t>(1LL, stream->reference_count)) * static_cast<std::int64_t>(stream->priority);
-      vect.push_back(std::make_pair(cost, stream));
+      }
+      Update(*stream);
     }
-    std::sort(vect.begin(), vect.end());
-    for (auto iter = vect.rbegin(); (iter != vect.rend()) && (pool->available() < request); iter++)
-      iter->second->Close();
+    std::stable_partition(spared.begin(), spared.end(), [](Streams::HybridStream const* s) { return s->revive_cost_ != Streams::UNKNOWN_REVIVE_COST; });
+    for (auto s : spared) {
+      if (pool->available() < request) {
+        Discard(*s);
+        statistics_.discards++;
+      }
+      Update(*s);
+    }
+  }
+
+  // how much a stream deserves to be in hot storage, per block: frequently used, high priority and small streams first
+  std::int64_t Manager::Heat(Streams::HybridStream const& stream) const {
+    std::int64_t const uses = static_cast<std::int64_t>(stream.policy.frequency) + 1;
+    std::int64_t const weight = 1 + static_cast<std::int64_t>(Streams::Priority::Low) - static_cast<std::int64_t>(stream.priority());
+    return uses * weight * Storage::BLOCK_SIZEi64 * Storage::BLOCK_SIZEi64 / std::max<std::int64_t>(Storage::BLOCK_SIZEi64, stream.capacity());
   }
 
-  Manager::Manager(std::int64_t const hot_storage, std::int64_t const cold_storage) :
-    streams(Storage::Manager::DEFAULT_BUCKET_COUNT)
+  // brings the cold storage of a frequently used stream back to memory, moving colder streams out of the way if needed,
+  // so that over time the hot tier holds the working set
+  void Manager::Promote(Streams::HybridStream& stream) {
+    if ((!stream.Active()) || (stream.policy.frequency < Storage::Manager::FREQUENT_USE))
+      return;
+    std::int64_t const cold = pool->Resident(*stream.arena, Storage::Type::Disk);
+    if ((cold == 0) || (cold > pool->hot_capacity() / Storage::Manager::PROMOTION_SHARE))
+      return;
+    std::int64_t const heat = Heat(stream);
+    Streams::HybridStream* victim;
+    while ((pool->hot_available() < cold) && ((victim = Victim(true)) != nullptr) && (Heat(*victim) < heat)) {
+      Remove(*victim);
+      bool const demoted = victim->CommitToDisk();
+      Update(*victim);
+      if (!demoted)
+        break;
+      statistics_.demotions++;
+    }
+    if ((pool->hot_available() >= cold) && pool->Promote(*stream.arena))
+      statistics_.promotions++;
+    Update(stream);
+  }
+
+  Manager::Manager(std::int64_t const hot_storage, std::int64_t const cold_storage, std::int64_t const compressed_storage, std::vector<std::string> const& directories, bool const direct_io, bool const deduplicate) :
+    policy(new Storage::SizePolicy()),
+    statistics_{}
   {
-    pool = std::shared_ptr<Storage::Pool>(new Storage::Pool(hot_storage, cold_storage));
-    capacity_ = available_ = pool->capacity();
+    for (auto& shard : registry)
+      shard.streams.reserve(Storage::Manager::DEFAULT_BUCKET_COUNT / Storage::Manager::REGISTRY_SHARDS);
+    pool = std::shared_ptr<Storage::Pool>(new Storage::Pool(hot_storage, cold_storage, compressed_storage, directories, direct_io, deduplicate));
+    capacity_ = pool->capacity();
   }
 
   Manager::~Manager() {
-    for (auto stream : streams) {
-      stream->Close();
-      delete stream;
+    for (auto& heap : heaps)
+      heap.clear();
+    for (auto& shard : registry) {
+      for (auto stream : shard.streams) {
+        stream->Close();
+        delete stream;
+      }
     }
   }
 
   void Manager::Deallocate(Streams::HybridStream& stream) {
-    if (streams.find(&stream) != streams.end())
-      stream.Close();
+    if (Registered(&stream)) {
+      std::lock_guard<std::mutex> lock(mutex);
+      Discard(stream);
+      Update(stream);
+    }
   }
 
   void Manager::Delete(Streams::HybridStream* stream) {
-    auto iter = streams.find(stream);
-    if (iter != streams.end()) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Storage::Manager::Shard& shard = Locate(stream);
+    std::lock_guard<std::mutex> registration(shard.mutex);
+    auto iter = shard.streams.find(stream);
+    if (iter != shard.streams.end()) {
+      Remove(*stream);
+      policy->Forget(*stream);
       stream->Close();
       delete stream;
-      streams.erase(iter);
+      shard.streams.erase(iter);
     }
   }
 
-  Streams::HybridStream* Manager::Allocate(std::int64_t size) {
+  Streams::HybridStream* Manager::Allocate(std::int64_t size, bool const growable, Streams::Lease* const lease, Storage::AllocationStrategy const placement) {
     size = Storage::RoundToBlockMultiple(size);
     if (size > pool->capacity())
       return nullptr;
-    else if (size > pool->available()) {
-      Purge(size);
+    bool const cold = (placement == Storage::AllocationStrategy::Cold);
+    // the lock is only needed up front to make room, so storage for streams that fit is taken by several threads in parallel
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    Storage::Expected<std::unique_ptr<Storage::Arena>> arena = Storage::Error::Exhausted;
+    if (cold || (size <= pool->hot_available()))
+      arena = pool->Allocate(size, placement);
+    if (!arena) {
+      if (cold)
+        return nullptr;
+      lock.lock();
+      Purge(size, pool->HotDemand(size));
       if (size > pool->available())
         return nullptr;
+      arena = pool->Allocate(size, placement);
+      if (!arena)
+        return nullptr;
     }
-    Streams::HybridStream* stream;
-    try {
-      stream = new Streams::HybridStream(size, pool);
-    }
-    catch (Storage::Exhausted const&) {
-      return nullptr;
-    }
-    if (!streams.insert(stream).second) {
-      // insertion failed, for some reason
-      stream->Close();
-      return nullptr;
+    Streams::HybridStream* stream = new Streams::HybridStream(std::move(*arena), pool);
+    // leased before the manager knows about it, so it's never a candidate for purging
+    if (lease != nullptr)
+      *lease = Streams::Lease(stream);
+    stream->manager = this;
+    stream->growable_ = growable;
+    stream->placement = placement;
+    if (!lock.owns_lock())
+      lock.lock();
+    {
+      Storage::Manager::Shard& shard = Locate(stream);
+      std::lock_guard<std::mutex> registration(shard.mutex);
+      if (!shard.streams.insert(stream).second) {
+        // insertion failed, for some reason
+        stream->manager = nullptr;
+        if (lease != nullptr)
+          lease->Release();
+        stream->Close();
+        return nullptr;
+      }
     }
+    policy->Admit(*stream, false);
+    Update(*stream);
     return stream;
   }
 
+  // adds storage to a growable stream, making room for it if needed, unless it was placed in cold storage first
+  bool Manager::Grow(Streams::HybridStream& stream, std::int64_t const size) {
+    assert((size > 0) && ((size & Storage::BLOCK_MASKi64) == 0));
+    std::lock_guard<std::mutex> lock(mutex);
+    if ((size > pool->hot_available()) && (stream.placement != Storage::AllocationStrategy::Cold)) {
+      // the stream itself must not be purged to make room for its own growth
+      Remove(stream);
+      Purge(size, pool->HotDemand(size));
+    }
+    bool const grown = (size <= pool->available()) && pool->Reallocate(*stream.arena, size, stream.placement);
+    Update(stream);
+    return grown;
+  }
+
   void Manager::Reallocate(Streams::HybridStream& stream) {
-    if (streams.find(&stream) != streams.end()) {
+    if (Registered(&stream)) {
+      std::lock_guard<std::mutex> lock(mutex);
       std::int64_t size = stream.capacity();
-      if (size > pool->available()) {
-        Purge(size);
+      // streams that are used often or matter most go back to hot storage, the others are placed like new ones
+      bool const hot = (stream.priority() == Streams::Priority::High) || (stream.policy.frequency >= Storage::Manager::FREQUENT_USE);
+      if (size > pool->hot_available()) {
+        Purge(size, hot ? size : pool->HotDemand(size));
         if (size > pool->available())
           return;
       }
-      try {
-        stream.Restore();
-      }
-      catch (Storage::Exhausted const&) {
+      bool const revived = !stream.Active();
+      if (!stream.Restore(hot ? Storage::AllocationStrategy::Hot : Storage::AllocationStrategy::None))
         stream.Close();
+      if (revived && stream.Active()) {
+        statistics_.revivals++;
+        statistics_.revived += size;
+        policy->Admit(stream, true);
       }
+      Update(stream);
     }
   }
 
-  const std::int64_t & Manager::available() const {
+  std::int64_t Manager::available() const {
     return pool->available();
   }
 
+  void Manager::SetPolicy(std::unique_ptr<Storage::Policy> policy) {
+    assert(policy);
+    std::lock_guard<std::mutex> lock(mutex);
+    this->policy = std::move(policy);
+    // bookkeeping from the previous policy is meaningless to this one
+    for (auto& shard : registry) {
+      std::lock_guard<std::mutex> registration(shard.mutex);
+      for (auto stream : shard.streams) {
+        Remove(*stream);
+        stream->policy = {};
+        if (stream->Active())
+          this->policy->Admit(*stream, false);
+        Update(*stream);
+      }
+    }
+  }
+
+  Manager::Statistics Manager::statistics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics_;
+  }
+
 }
\ No newline at end of file
@@ -23,21 +23,63 @@
 
 #include "storage.hpp"
 #include "pool.hpp"
+#include "policy.hpp"
 #include "../streams/filestream.hpp"
 #include "../streams/hybridstream.hpp"
 #include <unordered_set>
+#include <mutex>
 
 namespace Storage {
 
+  // Streams can be used from any thread, but only by one at a time each, and must be leased while in use
+  // if other threads may be allocating storage, since purging demotes or discards any stream that isn't
   class Manager final : public Storage::Holder {
+    friend Streams::HybridStream;
   private:
     static constexpr std::size_t DEFAULT_BUCKET_COUNT = 4096;
+    static constexpr std::size_t REGISTRY_SHARDS = 16;  // number of independently locked sets the registry of streams is split into
+    static constexpr std::int64_t SPILL_COST = 2;  // relative cost per byte of writing a stream to cold storage and reading it back
+    static constexpr std::uint32_t FREQUENT_USE = 2;  // streams used at least this many times are placed in, or promoted to, hot storage
+    static constexpr std::int64_t PROMOTION_SHARE = 4;  // a stream is only promoted if its cold storage is at most this fraction of the hot tier
+    enum Heap { Hot, Cold };
+  public:
+    typedef struct Statistics {
+      std::uint64_t accesses;  // times a stream was used
+      std::uint64_t revivals;  // times a stream had to be revived before it could be used
+      std::int64_t revived;  // total size of the revived streams
+      std::uint64_t demotions;  // streams compressed or moved to cold storage to make room
+      std::uint64_t promotions;  // streams moved back from cold storage to hot storage, once used frequently
+      std::uint64_t discards;  // streams whose contents were discarded to make room
+    } Statistics;
+  private:
+    typedef struct Shard {
+      std::mutex mutex;
+      std::unordered_set<Streams::HybridStream*> streams;
+    } Shard;
     std::shared_ptr<Storage::Pool> pool;
-    std::unordered_set<Streams::HybridStream*> streams;
+    std::array<Storage::Manager::Shard, Storage::Manager::REGISTRY_SHARDS> registry;  // every stream allocated, looked up without taking the main lock
+    mutable std::mutex mutex;  // guards the heaps, the policy and the statistics, and is held while purging
+    std::unique_ptr<Storage::Policy> policy;
+    Storage::Manager::Statistics statistics_;
+    // streams that can be purged, highest eviction cost first, split by whether they hold any hot storage and by policy queue
+    std::array<std::vector<Streams::HybridStream*>, 2 * Storage::Policy::MAX_QUEUES> heaps;
 
-    void Purge(std::int64_t const request);
+    Storage::Manager::Shard& Locate(Streams::HybridStream const* stream);
+    bool Registered(Streams::HybridStream* stream);
+    void SiftUp(std::vector<Streams::HybridStream*>& heap, std::size_t i);
+    void SiftDown(std::vector<Streams::HybridStream*>& heap, std::size_t i);
+    void Remove(Streams::HybridStream& stream);
+    void Update(Streams::HybridStream& stream);
+    void Notify(Streams::HybridStream& stream);
+    void Access(Streams::HybridStream& stream);
+    void Discard(Streams::HybridStream& stream);
+    Streams::HybridStream* Victim(bool const hot_only);
+    void Purge(std::int64_t const request, std::int64_t const hot);
+    std::int64_t Heat(Streams::HybridStream const& stream) const;
+    void Promote(Streams::HybridStream& stream);
+    bool Grow(Streams::HybridStream& stream, std::int64_t const size);
   public:
-    Manager(std::int64_t const hot_storage, std::int64_t const cold_storage);
+    Manager(std::int64_t const hot_storage, std::int64_t const cold_storage, std::int64_t const compressed_storage = 0, std::vector<std::string> const& directories = std::vector<std::string>(), bool const direct_io = false, bool const deduplicate = false);
     ~Manager();
     Manager(const Manager&) = delete;
     Manager& operator=(const Manager&) = delete;
@@ -45,9 +87,13 @@ namespace Storage {
     Manager& operator=(Manager&&) = delete;
     void Deallocate(Streams::HybridStream& stream);
     void Delete(Streams::HybridStream* stream);
-    Streams::HybridStream* Allocate(std::int64_t size);
+    // streams used while other threads allocate should be leased from the start, or they may be purged before they're written.
+    // streams placed in cold storage first only take what's free, and never purge others to make room, as they allocate or grow
+    Streams::HybridStream* Allocate(std::int64_t size, bool const growable = false, Streams::Lease* const lease = nullptr, Storage::AllocationStrategy const placement = Storage::AllocationStrategy::None);
     void Reallocate(Streams::HybridStream& stream);
-    const std::int64_t& available() const override;
+    std::int64_t available() const override;
+    void SetPolicy(std::unique_ptr<Storage::Policy> policy);
+    Storage::Manager::Statistics statistics() const;
   };
 
 }  // namespace Storage
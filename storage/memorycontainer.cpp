@@ -18,27 +18,124 @@
 */
 
 #include "memorycontainer.hpp"
+#ifndef WINDOWS
+#  include <sys/mman.h>
+#endif
 
 namespace Storage {
 
-  MemoryContainer::MemoryContainer(std::int64_t size) : Container(size) {
-    // create the memory buffer
-    try {
-      buffer = std::unique_ptr<std::uint8_t[]>(new std::uint8_t[static_cast<std::size_t>(size)]());
+  MemoryContainer::MemoryContainer(std::int64_t size) : Container(size), freed(0) {
+    // reserve the address space, physical memory is only committed as it's used
+#ifdef WINDOWS
+    buffer = static_cast<std::uint8_t*>(VirtualAlloc(nullptr, static_cast<SIZE_T>(capacity_), MEM_RESERVE, PAGE_NOACCESS));
+    if (buffer == nullptr)
+      throw Storage::Exhausted();
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#  ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#  endif
+    void* address = mmap(nullptr, static_cast<std::size_t>(capacity_), PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (address == MAP_FAILED)
+      throw Storage::Exhausted();
+    buffer = static_cast<std::uint8_t*>(address);
+#  ifdef MADV_HUGEPAGE
+    if (capacity_ >= MemoryContainer::HUGE_PAGES_THRESHOLD)
+      madvise(address, static_cast<std::size_t>(capacity_), MADV_HUGEPAGE);  // just a hint, failure is harmless
+#  endif
+#endif
+  }
+
+  MemoryContainer::~MemoryContainer() {
+#ifdef WINDOWS
+    VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+    munmap(buffer, static_cast<std::size_t>(capacity_));
+#endif
+  }
+
+  void MemoryContainer::Release() {
+    // return every aligned chunk fully inside a run of free blocks, one shard at a time,
+    // keeping it locked so that none of its blocks can be reused meanwhile
+    static_assert((Storage::SHARD_BLOCKS * Storage::BLOCK_SIZE) % MemoryContainer::RELEASE_GRANULARITY == 0, "Shards must cover whole chunks");
+    std::size_t const blocks_per_chunk = static_cast<std::size_t>(MemoryContainer::RELEASE_GRANULARITY / Storage::BLOCK_SIZEi64);
+    for (std::size_t shard = 0; shard < shard_count; shard++) {
+      std::lock_guard<std::mutex> lock(shards[shard].mutex);
+      std::size_t const end = End(shard);
+      for (std::size_t i = FindFree(shard * Storage::SHARD_BLOCKS, end), j; i < end; i = FindFree(j, end)) {
+        j = FindUsed(i, end);
+        std::size_t const first = (i + blocks_per_chunk - 1) / blocks_per_chunk * blocks_per_chunk, last = j / blocks_per_chunk * blocks_per_chunk;
+        if (first >= last)
+          continue;
+        std::uint8_t* const address = buffer + first * Storage::BLOCK_SIZE;
+        std::size_t const length = (last - first) * Storage::BLOCK_SIZE;
+#ifdef WINDOWS
+        VirtualFree(address, length, MEM_DECOMMIT);
+#elif defined(MADV_FREE)
+        madvise(address, length, MADV_FREE);
+#else
+        madvise(address, length, MADV_DONTNEED);
+#endif
+      }
     }
-    catch (...) { throw Storage::Exhausted(); }  // exception translation, to ensure consistent behavior
   }
 
-  bool MemoryContainer::Read(Storage::Block& block, Storage::Buffer& buf) {
-    assert(block.type == Storage::Type::Memory);
-    std::memcpy(buf.data(), &buffer[static_cast<std::size_t>(block.offset)], buf.size());
+  bool MemoryContainer::Allocate(std::int64_t const size, Storage::Arena& arena) {
+    std::size_t const n = arena.extents.size();
+    std::int64_t const tail = (n > 0) ? arena.extents.back().length : 0;  // the new storage may be merged into this extent
+    if (!Container::Allocate(size, arena))
+      return false;
+#ifdef WINDOWS
+    // commit the new storage
+    Storage::Arena added;
+    for (std::size_t i = (n > 0) ? n - 1 : 0; i < arena.extents.size(); i++) {
+      Storage::Extent extent = arena.extents[i];
+      if ((n > 0) && (i == n - 1))
+        extent.offset += tail, extent.length -= tail;
+      if ((extent.type == Storage::Type::Memory) && (extent.length > 0))
+        Storage::Append(added, extent);
+    }
+    for (auto const& extent : added.extents) {
+      if (VirtualAlloc(buffer + extent.offset, static_cast<SIZE_T>(extent.length), MEM_COMMIT, PAGE_READWRITE) == nullptr) {
+        // undo the allocation
+        Container::Deallocate(added);
+        arena.extents.resize(n);
+        if (n > 0)
+          arena.extents.back().length = tail;
+        arena.size -= size;
+        return false;
+      }
+    }
+#else
+    (void)tail;
+#endif
     return true;
   }
 
-  bool MemoryContainer::Write(Storage::Block& block, Storage::Buffer& buf) {
-    assert(block.type == Storage::Type::Memory);
-    std::memcpy(&buffer[static_cast<std::size_t>(block.offset)], buf.data(), buf.size());
-    return true;
+  void MemoryContainer::Deallocate(Storage::Arena& arena, bool const erase) {
+    for (auto const& extent : arena.extents) {
+      if (extent.type == Storage::Type::Memory)
+        freed += extent.length;
+    }
+    Container::Deallocate(arena, erase);
+    // only one of the threads crossing the threshold at the same time does the work
+    if ((freed >= MemoryContainer::RELEASE_THRESHOLD) && (freed.exchange(0) >= MemoryContainer::RELEASE_THRESHOLD))
+      Release();
+  }
+
+  void MemoryContainer::Read(std::int64_t const offset, void* buf, std::size_t const count) {
+    assert((offset >= 0) && (offset + static_cast<std::int64_t>(count) <= capacity_));
+    std::memcpy(buf, &buffer[static_cast<std::size_t>(offset)], count);
+  }
+
+  void MemoryContainer::Write(std::int64_t const offset, void const* buf, std::size_t const count) {
+    assert((offset >= 0) && (offset + static_cast<std::int64_t>(count) <= capacity_));
+    std::memcpy(&buffer[static_cast<std::size_t>(offset)], buf, count);
+  }
+
+  std::uint8_t const* MemoryContainer::Data(std::int64_t const offset) const {
+    assert((offset >= 0) && (offset < capacity_));
+    return &buffer[static_cast<std::size_t>(offset)];
   }
 
 }
\ No newline at end of file
@@ -22,17 +22,25 @@
 #define MEMORYCONTAINER_HPP
 
 #include "container.hpp"
-#include <unordered_map>
 
 namespace Storage {
 
-  class MemoryContainer final : public Container<Storage::Type::Memory, std::unordered_map> {
+  class MemoryContainer final : public Container<Storage::Type::Memory> {
   private:
-    std::unique_ptr<std::uint8_t[]> buffer;
+    static constexpr std::int64_t HUGE_PAGES_THRESHOLD = 0x4000000;  // minimum size for using transparent huge pages (64 MB)
+    static constexpr std::int64_t RELEASE_GRANULARITY = 0x200000;  // free runs are returned to the OS in aligned chunks of this size (2 MB)
+    static constexpr std::int64_t RELEASE_THRESHOLD = 0x2000000;  // amount of storage freed before looking for runs to return (32 MB)
+    std::uint8_t* buffer;  // reserved address space, only backed by physical memory once it's used
+    std::atomic<std::int64_t> freed;  // storage freed since memory was last returned to the OS
+    void Release();
   public:
     MemoryContainer(std::int64_t size);
-    bool Read(Storage::Block& block, Storage::Buffer& buf);
-    bool Write(Storage::Block& block, Storage::Buffer& buf);
+    ~MemoryContainer();
+    bool Allocate(std::int64_t const size, Storage::Arena& arena);
+    void Deallocate(Storage::Arena& arena, bool const erase = false);
+    void Read(std::int64_t const offset, void* buf, std::size_t const count);
+    void Write(std::int64_t const offset, void const* buf, std::size_t const count);
+    std::uint8_t const* Data(std::int64_t const offset) const;
   };
 
 }  // namespace Storage
@@ -0,0 +1,161 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "policy.hpp"
+#include "../streams/hybridstream.hpp"
+
+namespace Storage {
+
+  Storage::Policy::Entry& Policy::Data(Streams::HybridStream& stream) {
+    return stream.policy;
+  }
+
+  Storage::Policy::Entry const& Policy::Data(Streams::HybridStream const& stream) {
+    return stream.policy;
+  }
+
+  void Policy::Admit(Streams::HybridStream& stream, bool const) {
+    Storage::Policy::Entry& entry = Data(stream);
+    entry.tick = ++clock;
+    entry.ghost = false;
+  }
+
+  void Policy::Access(Streams::HybridStream& stream) {
+    Storage::Policy::Entry& entry = Data(stream);
+    entry.tick = ++clock;
+    entry.frequency++;
+  }
+
+  void Policy::Evict(Streams::HybridStream& stream) {
+    Data(stream).ghost = true;
+  }
+
+  void Policy::Forget(Streams::HybridStream&) {}
+
+  std::size_t Policy::Queue(Streams::HybridStream const&) const {
+    return 0;
+  }
+
+  std::size_t Policy::Select(std::array<bool, Storage::Policy::MAX_QUEUES> const& candidates) {
+    return candidates[0] ? 0 : 1;
+  }
+
+  std::int64_t SizePolicy::Cost(Streams::HybridStream const& stream) const {
+    return (stream.capacity() / std::max<std::int64_t>(1LL, stream.reference_count())) * static_cast<std::int64_t>(stream.priority());
+  }
+
+  std::int64_t LRUPolicy::Cost(Streams::HybridStream const& stream) const {
+    return -static_cast<std::int64_t>(Data(stream).tick);
+  }
+
+  void ARCPolicy::Move(Streams::HybridStream& stream, std::uint32_t const queue) {
+    Storage::Policy::Entry& entry = Data(stream);
+    sizes[entry.queue] -= entry.charged;
+    entry.charged = stream.capacity();
+    sizes[entry.queue = queue] += entry.charged;
+  }
+
+  void ARCPolicy::Admit(Streams::HybridStream& stream, bool const revived) {
+    Storage::Policy::Entry& entry = Data(stream);
+    std::int64_t const size = stream.capacity();
+    if (revived && entry.ghost) {
+      // a hit in a ghost queue means that queue should have been larger
+      std::uint32_t const queue = entry.queue;
+      std::int64_t const delta = std::max<std::int64_t>(size, (ghosts[queue ^ 1] / std::max<std::int64_t>(1LL, ghosts[queue])) * size);
+      if (queue == Storage::ARCPolicy::Queues::Recent)
+        target = std::min<std::int64_t>(target + delta, sizes[0] + sizes[1] + size);
+      else
+        target = std::max<std::int64_t>(target - delta, 0LL);
+      ghosts[queue] -= entry.charged;
+      entry.queue = Storage::ARCPolicy::Queues::Frequent;
+    }
+    else
+      entry.queue = Storage::ARCPolicy::Queues::Recent;
+    entry.charged = size;
+    sizes[entry.queue] += size;
+    Policy::Admit(stream, revived);
+  }
+
+  void ARCPolicy::Access(Streams::HybridStream& stream) {
+    // ghosts only move when they're readmitted
+    if (Data(stream).ghost)
+      return;
+    if (Data(stream).queue == Storage::ARCPolicy::Queues::Recent)
+      Move(stream, Storage::ARCPolicy::Queues::Frequent);
+    Policy::Access(stream);
+  }
+
+  void ARCPolicy::Evict(Streams::HybridStream& stream) {
+    Storage::Policy::Entry const& entry = Data(stream);
+    if (entry.ghost)
+      return;
+    sizes[entry.queue] -= entry.charged;
+    ghosts[entry.queue] += entry.charged;
+    Policy::Evict(stream);
+  }
+
+  void ARCPolicy::Forget(Streams::HybridStream& stream) {
+    Storage::Policy::Entry const& entry = Data(stream);
+    if (entry.ghost)
+      ghosts[entry.queue] -= entry.charged;
+    else
+      sizes[entry.queue] -= entry.charged;
+  }
+
+  std::size_t ARCPolicy::Queue(Streams::HybridStream const& stream) const {
+    return Data(stream).queue;
+  }
+
+  std::int64_t ARCPolicy::Cost(Streams::HybridStream const& stream) const {
+    return -static_cast<std::int64_t>(Data(stream).tick);
+  }
+
+  std::size_t ARCPolicy::Select(std::array<bool, Storage::Policy::MAX_QUEUES> const& candidates) {
+    if (candidates[Storage::ARCPolicy::Queues::Recent] && ((sizes[Storage::ARCPolicy::Queues::Recent] > target) || (!candidates[Storage::ARCPolicy::Queues::Frequent])))
+      return Storage::ARCPolicy::Queues::Recent;
+    return Storage::ARCPolicy::Queues::Frequent;
+  }
+
+  std::int64_t GDSFPolicy::Value(Streams::HybridStream const& stream) const {
+    Storage::Policy::Entry const& entry = Data(stream);
+    // revive cost already accounts for the ancestors that may need reviving too
+    std::int64_t const cost = std::max<std::int64_t>(1LL, stream.revive_cost()) * Storage::GDSFPolicy::SCALE / std::max<std::int64_t>(1LL, stream.capacity());
+    return entry.value + static_cast<std::int64_t>(std::max<std::uint32_t>(1u, entry.frequency)) * cost;
+  }
+
+  void GDSFPolicy::Admit(Streams::HybridStream& stream, bool const revived) {
+    Policy::Admit(stream, revived);
+    Data(stream).value = inflation;
+  }
+
+  void GDSFPolicy::Access(Streams::HybridStream& stream) {
+    Policy::Access(stream);
+    Data(stream).value = inflation;
+  }
+
+  void GDSFPolicy::Evict(Streams::HybridStream& stream) {
+    inflation = std::max<std::int64_t>(inflation, Value(stream));
+    Policy::Evict(stream);
+  }
+
+  std::int64_t GDSFPolicy::Cost(Streams::HybridStream const& stream) const {
+    return -Value(stream);
+  }
+
+}
\ No newline at end of file
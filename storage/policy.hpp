@@ -0,0 +1,109 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef POLICY_HPP
+#define POLICY_HPP
+
+#include "storage.hpp"
+
+namespace Streams {
+  class HybridStream;
+}
+
+namespace Storage {
+
+  // A Policy decides in which order the streams of a manager are demoted or discarded when storage runs out
+  class Policy {
+  public:
+    static constexpr std::size_t MAX_QUEUES = 2;
+    // bookkeeping kept in every stream for the policy in use
+    typedef struct Entry {
+      std::uint64_t tick;  // time of the last access
+      std::uint32_t frequency;  // number of accesses
+      std::uint32_t queue;
+      std::int64_t value;  // policy specific
+      std::int64_t charged;  // size accounted for in the totals of the policy, since the capacity of growable streams changes
+      bool ghost;  // contents were discarded, but the access history is still being tracked
+    } Entry;
+  protected:
+    std::uint64_t clock = 0;
+    static Storage::Policy::Entry& Data(Streams::HybridStream& stream);
+    static Storage::Policy::Entry const& Data(Streams::HybridStream const& stream);
+  public:
+    virtual ~Policy() = default;
+    virtual void Admit(Streams::HybridStream& stream, bool const revived);  // allocated, or revived after being discarded
+    virtual void Access(Streams::HybridStream& stream);  // used while its contents are available
+    virtual void Evict(Streams::HybridStream& stream);  // contents discarded
+    virtual void Forget(Streams::HybridStream& stream);  // about to be deleted
+    // which queue the stream belongs to, and its cost in that queue (higher is evicted first)
+    virtual std::size_t Queue(Streams::HybridStream const& stream) const;
+    virtual std::int64_t Cost(Streams::HybridStream const& stream) const = 0;
+    // pick a queue to take the next victim from, given which ones have candidates
+    virtual std::size_t Select(std::array<bool, Storage::Policy::MAX_QUEUES> const& candidates);
+  };
+
+  // larger, less referenced and lower priority streams first
+  class SizePolicy final : public Storage::Policy {
+  public:
+    std::int64_t Cost(Streams::HybridStream const& stream) const override;
+  };
+
+  // least recently used first
+  class LRUPolicy final : public Storage::Policy {
+  public:
+    std::int64_t Cost(Streams::HybridStream const& stream) const override;
+  };
+
+  // Adaptive Replacement Cache: streams used once and streams used again are kept in separate LRU queues,
+  // and the share of each adapts to which kind of discarded streams end up being revived
+  class ARCPolicy final : public Storage::Policy {
+  private:
+    enum Queues { Recent, Frequent };
+    std::int64_t sizes[2] = {};  // total size of the streams in each queue
+    std::int64_t ghosts[2] = {};  // total size of the discarded streams still tracked for each queue
+    std::int64_t target = 0;  // target size for the queue of recent streams
+    void Move(Streams::HybridStream& stream, std::uint32_t const queue);
+  public:
+    void Admit(Streams::HybridStream& stream, bool const revived) override;
+    void Access(Streams::HybridStream& stream) override;
+    void Evict(Streams::HybridStream& stream) override;
+    void Forget(Streams::HybridStream& stream) override;
+    std::size_t Queue(Streams::HybridStream const& stream) const override;
+    std::int64_t Cost(Streams::HybridStream const& stream) const override;
+    std::size_t Select(std::array<bool, Storage::Policy::MAX_QUEUES> const& candidates) override;
+  };
+
+  // GreedyDual-Size-Frequency: the least valuable first, by frequency of use and revive cost per byte,
+  // with an inflation value so that streams that aren't used anymore eventually age out
+  class GDSFPolicy final : public Storage::Policy {
+  private:
+    static constexpr std::int64_t SCALE = 4096;  // fixed point scale for the values
+    std::int64_t inflation = 0;  // value of the last stream discarded
+    std::int64_t Value(Streams::HybridStream const& stream) const;
+  public:
+    void Admit(Streams::HybridStream& stream, bool const revived) override;
+    void Access(Streams::HybridStream& stream) override;
+    void Evict(Streams::HybridStream& stream) override;
+    std::int64_t Cost(Streams::HybridStream const& stream) const override;
+  };
+
+}  // namespace Storage
+
+#endif  // POLICY_HPP
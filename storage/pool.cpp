@@ -21,137 +21,392 @@
 
 namespace Storage {
 
-  bool Pool::ReadBlock(Storage::Block& block, Storage::Buffer& buf) {
-    if (block.type == Storage::Type::Disk)
-      return disk.Read(block, buf);
-    else
-      return memory.Read(block, buf);
-  }
-
-  bool Pool::WriteBlock(Storage::Block& block, Storage::Buffer& buf) {
-    if (block.type == Storage::Type::Disk)
-      return disk.Write(block, buf);
-    else
-      return memory.Write(block, buf);
-  }
-
-  std::size_t Pool::ProcessRequest(void* buffer, std::size_t count, Storage::Arena& arena, Storage::Pool::Request const request) {
-    std::int64_t total = static_cast<std::int64_t>(arena.blocks.size()) * Storage::BLOCK_SIZEi64;
-    assert(arena.position <= total);
-    if (arena.position + static_cast<std::int64_t>(count) > total)
-      count = static_cast<std::size_t>(total - arena.position);
-    if (count == 0)
-      return 0;
-    Storage::Buffer buf{};
-    std::size_t offset = static_cast<std::size_t>(arena.position / Storage::BLOCK_SIZEi64);
-    std::size_t index = static_cast<std::size_t>(arena.position & Storage::BLOCK_MASKi64);
-    Block* b = arena.blocks[offset];
-    if (!ReadBlock(*b, buf))
-      return 0;
-    std::size_t n = std::min<std::size_t>(buf.size() - index, count);
-    if (request == Storage::Pool::Request::Read)
-      std::memcpy(buffer, buf.data() + index, n);
-    else {
-      std::memcpy(buf.data() + index, buffer, n);
-      if (!WriteBlock(*b, buf))
-        return 0;
-    }
-    arena.position += n;
-    offset++;
-    if (request == Storage::Pool::Request::Read) {
-      for (; n + buf.size() <= count; offset++, n += buf.size(), arena.position += buf.size()) {
-        if (!ReadBlock(*arena.blocks[offset], buf))
-          return n;
-        std::memcpy(static_cast<std::uint8_t*>(buffer) + n, buf.data(), buf.size());
+  static inline std::uint64_t Hash(std::uint8_t const* data) {
+    std::uint64_t hash = 0;
+    for (std::size_t i = 0; i < Storage::BLOCK_SIZE; i += sizeof(std::uint64_t)) {
+      std::uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      hash = ((hash ^ word) * 0x9E3779B97F4A7C15ULL);
+      hash ^= hash >> 29;
+    }
+    return hash;
+  }
+
+  std::size_t Pool::Locate(Storage::Arena const& arena, std::int64_t& offset) {
+    assert((offset >= 0) && (offset < arena.size));
+    std::size_t i = 0;
+    for (; offset >= arena.extents[i].length; i++)
+      offset -= arena.extents[i].length;
+    return i;
+  }
+
+  // makes the block at the given position in an arena use different storage
+  void Pool::Remap(Storage::Arena& arena, std::int64_t const position, Storage::Extent const& block) {
+    assert(((position & Storage::BLOCK_MASKi64) == 0) && (block.length == Storage::BLOCK_SIZEi64));
+    std::vector<Storage::Extent> extents;
+    extents.swap(arena.extents);
+    arena.size = 0;
+    for (auto const& extent : extents) {
+      std::int64_t const index = position - arena.size;
+      if ((index < 0) || (index >= extent.length)) {
+        Storage::Append(arena, extent);
+        continue;
       }
+      if (index > 0)
+        Storage::Append(arena, { extent.type, extent.offset, index });
+      Storage::Append(arena, block);
+      if (index + Storage::BLOCK_SIZEi64 < extent.length)
+        Storage::Append(arena, { extent.type, extent.offset + index + Storage::BLOCK_SIZEi64, extent.length - index - Storage::BLOCK_SIZEi64 });
     }
-    else {
-      for (; n + buf.size() <= count; offset++, n += buf.size(), arena.position += buf.size()) {
-        std::memcpy(buf.data(), static_cast<std::uint8_t*>(buffer) + n, buf.size());
-        if (!WriteBlock(*arena.blocks[offset], buf))
-          return n;
+  }
+
+  void Pool::Unindex(std::size_t const block) {
+    auto const entry = catalog.find(hashes[block]);
+    if ((entry != catalog.end()) && (entry->second == block))
+      catalog.erase(entry);
+  }
+
+  // frees the memory storage of an arena, except for blocks still shared with others
+  void Pool::Release(Storage::Arena& arena) {
+    if (!deduplicate) {
+      memory.Deallocate(arena);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(sharing);
+    Storage::Arena freed;
+    for (auto const& extent : arena.extents) {
+      if (extent.type != Storage::Type::Memory)
+        continue;
+      for (std::int64_t offset = extent.offset; offset < extent.offset + extent.length; offset += Storage::BLOCK_SIZEi64) {
+        std::size_t const block = static_cast<std::size_t>(offset / Storage::BLOCK_SIZEi64);
+        if (shares[block] > 0)
+          shares[block]--;
+        else {
+          Unindex(block);
+          Storage::Append(freed, { Storage::Type::Memory, offset, Storage::BLOCK_SIZEi64 });
+        }
       }
     }
-    if (n < count) {
-      if (request == Storage::Pool::Request::Read) {
-        if (!ReadBlock(*arena.blocks[offset], buf))
-          return n;
-        std::memcpy(static_cast<std::uint8_t*>(buffer) + n, buf.data(), count - n);
+    memory.Deallocate(freed);
+  }
+
+  // makes sure the memory blocks about to be written in the given range belong to this arena only, copying them if needed
+  bool Pool::Unshare(Storage::Arena& arena, std::int64_t const first, std::int64_t const last) {
+    std::lock_guard<std::mutex> lock(sharing);
+    for (std::int64_t position = first & ~Storage::BLOCK_MASKi64; position < last; position += Storage::BLOCK_SIZEi64) {
+      std::int64_t index = position;
+      Storage::Extent const extent = arena.extents[Locate(arena, index)];
+      if (extent.type != Storage::Type::Memory)
+        continue;
+      std::size_t const block = static_cast<std::size_t>((extent.offset + index) / Storage::BLOCK_SIZEi64);
+      if (shares[block] == 0) {
+        Unindex(block);  // its contents are about to change
+        continue;
+      }
+      Storage::Arena copy;
+      if (!((memory.available() >= Storage::BLOCK_SIZEi64) ? memory.Allocate(Storage::BLOCK_SIZEi64, copy) : disk.Allocate(Storage::BLOCK_SIZEi64, copy)))
+        return false;
+      Storage::Extent const& target = copy.extents[0];
+      if (target.type == Storage::Type::Memory)
+        memory.Write(target.offset, memory.Data(extent.offset + index), Storage::BLOCK_SIZE);
+      else if (!disk.Write(target.offset, memory.Data(extent.offset + index), Storage::BLOCK_SIZE)) {
+        disk.Deallocate(copy);
+        return false;
+      }
+      shares[block]--;
+      Remap(arena, position, target);
+    }
+    return true;
+  }
+
+  // shares every memory block whose last byte was just written with any other block with the same contents
+  void Pool::Deduplicate(Storage::Arena& arena, std::int64_t const first, std::int64_t const last) {
+    std::lock_guard<std::mutex> lock(sharing);
+    Storage::Arena freed;
+    for (std::int64_t position = first & ~Storage::BLOCK_MASKi64; position + Storage::BLOCK_SIZEi64 <= last; position += Storage::BLOCK_SIZEi64) {
+      std::int64_t index = position;
+      Storage::Extent const extent = arena.extents[Locate(arena, index)];
+      if (extent.type != Storage::Type::Memory)
+        continue;
+      std::int64_t const offset = extent.offset + index;
+      std::size_t const block = static_cast<std::size_t>(offset / Storage::BLOCK_SIZEi64);
+      std::uint8_t const* data = memory.Data(offset);
+      std::uint64_t const hash = Hash(data);
+      auto const entry = catalog.find(hash);
+      if (entry == catalog.end()) {
+        catalog.emplace(hash, block);
+        hashes[block] = hash;
+        continue;
+      }
+      std::int64_t const shared = static_cast<std::int64_t>(entry->second) * Storage::BLOCK_SIZEi64;
+      if ((entry->second == block) || (std::memcmp(memory.Data(shared), data, Storage::BLOCK_SIZE) != 0))
+        continue;
+      shares[entry->second]++;
+      Remap(arena, position, { Storage::Type::Memory, shared, Storage::BLOCK_SIZEi64 });
+      Storage::Append(freed, { Storage::Type::Memory, offset, Storage::BLOCK_SIZEi64 });
+    }
+    memory.Deallocate(freed);
+  }
+
+  // reads or writes at the given offset, without using or changing the position of the arena
+  std::size_t Pool::ProcessRequest(void* buffer, std::size_t count, Storage::Arena const& arena, std::int64_t const offset, Storage::Pool::Request const request) {
+    if ((offset < 0) || (offset >= arena.size))
+      return 0;
+    if (offset + static_cast<std::int64_t>(count) > arena.size)
+      count = static_cast<std::size_t>(arena.size - offset);
+    std::uint8_t* data = static_cast<std::uint8_t*>(buffer);
+    std::int64_t index = offset;
+    std::size_t n = 0;
+    // every extent is physically contiguous, so it can be processed with a single request
+    for (std::size_t i = Locate(arena, index); n < count; i++, index = 0) {
+      Storage::Extent const& extent = arena.extents[i];
+      std::size_t const length = static_cast<std::size_t>(std::min<std::int64_t>(extent.length - index, static_cast<std::int64_t>(count - n)));
+      std::int64_t const address = extent.offset + index;
+      if (extent.type == Storage::Type::Memory) {
+        if (request == Storage::Pool::Request::Read)
+          memory.Read(address, data + n, length);
+        else
+          memory.Write(address, data + n, length);
       }
-      else {
-        std::memcpy(buf.data(), static_cast<std::uint8_t*>(buffer) + n, count - n);
-        if (!WriteBlock(*arena.blocks[offset], buf))
-          return n;
+      else if (extent.type == Storage::Type::Compressed) {
+        if (!((request == Storage::Pool::Request::Read) ? compressed.Read(address, data + n, length) : compressed.Write(address, data + n, length)))
+          break;
       }
-      arena.position += count - n;
+      else if (!((request == Storage::Pool::Request::Read) ? disk.Read(address, data + n, length) : disk.Write(address, data + n, length)))
+        break;
+      n += length;
     }
-    return count;
+    return n;
   }
 
-  Pool::Pool(std::int64_t const memory_size, std::int64_t const disk_size) : memory(memory_size), disk(disk_size) {
-    capacity_ = available_ = disk.capacity() + memory.capacity();
+  // how much of a request with no explicit strategy goes to memory, with the rest going to disk:
+  // small requests get all they need, while large ones can't take over the memory tier
+  std::int64_t Pool::HotShare(std::int64_t const size) const {
+    std::int64_t const available = memory.available(), capacity = memory.capacity();
+    std::int64_t share = std::min<std::int64_t>(available, size);
+    if (size > capacity / Storage::Pool::SMALL_SHARE)
+      share = std::min<std::int64_t>(share, std::max<std::int64_t>(0LL, (available - capacity / Storage::Pool::RESERVE_SHARE) & ~Storage::BLOCK_MASKi64));
+    // but never leave more for disk than it can hold
+    return std::max<std::int64_t>(share, std::min<std::int64_t>(available, size - disk.available()));
+  }
+
+  // how much free memory a request with no explicit strategy needs to be placed as intended: small ones are placed in memory
+  // whole, so room must be made for them, while large ones just take their share of whatever memory is free
+  std::int64_t Pool::HotDemand(std::int64_t const size) const {
+    return (size > memory.capacity() / Storage::Pool::SMALL_SHARE) ? 0 : size;
+  }
+
+  Pool::Pool(std::int64_t const memory_size, std::int64_t const disk_size, std::int64_t const compressed_size, std::vector<std::string> const& directories, bool const direct_io, bool const deduplicate) :
+    memory(memory_size),
+    disk(disk_size, directories, direct_io),
+    compressed(compressed_size),
+    deduplicate(deduplicate)
+  {
+    if (deduplicate) {
+      std::size_t const blocks = static_cast<std::size_t>(memory.capacity() / Storage::BLOCK_SIZEi64);
+      shares.resize(blocks, 0);
+      hashes.resize(blocks, 0);
+    }
+    // compressed storage can't be allocated directly, so it doesn't count
+    capacity_ = disk.capacity() + memory.capacity();
   }
 
   Pool::~Pool() {
   }
 
-  std::unique_ptr<Storage::Arena> Pool::Allocate(std::int64_t size, Storage::AllocationStrategy const strategy) {
+  Storage::Expected<std::unique_ptr<Storage::Arena>> Pool::Allocate(std::int64_t size, Storage::AllocationStrategy const strategy) {
     std::unique_ptr<Storage::Arena> arena(new Arena());
-    Reallocate(*arena, size, strategy);
+    if (!Reallocate(*arena, size, strategy))
+      return Storage::Error::Exhausted;
     return arena;
   }
 
-  void Pool::Reallocate(Storage::Arena& arena, std::int64_t size, Storage::AllocationStrategy const strategy) {
+  // returns false, leaving the arena untouched, if there isn't enough storage available
+  bool Pool::Reallocate(Storage::Arena& arena, std::int64_t size, Storage::AllocationStrategy const strategy) {
     size = RoundToBlockMultiple(size);
-    if ((size > available_) || (size < Storage::BLOCK_SIZEi64))
-      throw Storage::Exhausted();
+    if ((size > available()) || (size < Storage::BLOCK_SIZEi64))
+      return false;
 
     Storage::Type primary = Storage::Type::Memory;
     std::int64_t alloc = 0LL;
-    if (strategy == Storage::AllocationStrategy::None) {
-      alloc = std::min<std::int64_t>((primary == Storage::Type::Memory) ? memory.available() : disk.available(), size); // TODO: allocation strategy
-    }
+    if (strategy == Storage::AllocationStrategy::None)
+      alloc = HotShare(size);
     else {
       if (strategy == Storage::AllocationStrategy::Cold)
         primary = Storage::Type::Disk;
       alloc = std::min<std::int64_t>((primary == Storage::Type::Memory) ? memory.available() : disk.available(), size);
     }
-    if (primary == Storage::Type::Memory)
-      memory.Allocate(alloc, arena);
-    else
-      disk.Allocate(alloc, arena);
-    if (alloc < size) {
-      if (primary == Storage::Type::Memory)
-        disk.Allocate(size - alloc, arena);
-      else
-        memory.Allocate(size - alloc, arena);
+    // allocate on the side first, so a failure in either container leaves the arena untouched,
+    // and if another thread took the primary storage meanwhile, try to get it all from the other one
+    Storage::Arena first, second;
+    if (!((primary == Storage::Type::Memory) ? memory.Allocate(alloc, first) : disk.Allocate(alloc, first)))
+      alloc = 0;
+    if ((alloc < size) && !((primary == Storage::Type::Memory) ? disk.Allocate(size - alloc, second) : memory.Allocate(size - alloc, second))) {
+      memory.Deallocate(first);
+      disk.Deallocate(first);
+      return false;
     }
-    available_ = disk.available() + memory.available();
+    for (auto const& extent : first.extents)
+      Storage::Append(arena, extent);
+    for (auto const& extent : second.extents)
+      Storage::Append(arena, extent);
+    return true;
   }
 
   void Pool::Deallocate(Storage::Arena& arena) {
-    memory.Deallocate(arena);
+    assert(arena.pins == 0);
+    Release(arena);
     disk.Deallocate(arena);
-    available_ = disk.available() + memory.available();
-    arena.blocks.clear();
-    arena.blocks.shrink_to_fit();
+    compressed.Deallocate(arena);
+    arena.extents.clear();
+    arena.extents.shrink_to_fit();
+    arena.size = 0;
     arena.position = 0;
+    arena.incompressible = false;
+  }
+
+  // releases the storage of an arena past the given size, rounded up to whole blocks
+  void Pool::Truncate(Storage::Arena& arena, std::int64_t size) {
+    size = RoundToBlockMultiple(size);
+    Storage::Arena tail;
+    while (arena.size > size) {
+      Storage::Extent& extent = arena.extents.back();
+      std::int64_t const excess = std::min<std::int64_t>(extent.length, arena.size - size);
+      Storage::Append(tail, { extent.type, extent.offset + extent.length - excess, excess });
+      extent.length -= excess;
+      arena.size -= excess;
+      if (extent.length == 0)
+        arena.extents.pop_back();
+    }
+    Release(tail);
+    disk.Deallocate(tail);
+    compressed.Deallocate(tail);
+    arena.position = std::min<std::int64_t>(arena.position, arena.size);
   }
 
   std::size_t Pool::Read(void* buffer, std::size_t count, Storage::Arena& arena) {
-    return ProcessRequest(buffer, count, arena, Storage::Pool::Request::Read);
+    std::size_t const n = ReadAt(buffer, count, arena, arena.position);
+    arena.position += static_cast<std::int64_t>(n);
+    return n;
   }
 
   std::size_t Pool::Write(void* buffer, std::size_t count, Storage::Arena& arena) {
-    return ProcessRequest(buffer, count, arena, Storage::Pool::Request::Write);
+    std::size_t const n = WriteAt(buffer, count, arena, arena.position);
+    arena.position += static_cast<std::int64_t>(n);
+    return n;
+  }
+
+  // safe to use from several threads at once on the same arena, as long as none of them changes it meanwhile
+  std::size_t Pool::ReadAt(void* buffer, std::size_t count, Storage::Arena const& arena, std::int64_t const offset) {
+    return ProcessRequest(buffer, count, arena, offset, Storage::Pool::Request::Read);
+  }
+
+  std::size_t Pool::WriteAt(void* buffer, std::size_t count, Storage::Arena& arena, std::int64_t const offset) {
+    if (!deduplicate)
+      return ProcessRequest(buffer, count, arena, offset, Storage::Pool::Request::Write);
+    // copy-on-write for shared blocks
+    std::int64_t const first = offset, last = std::min<std::int64_t>(arena.size, first + static_cast<std::int64_t>(count));
+    if ((first < last) && !Unshare(arena, first, last))
+      return 0;
+    std::size_t const n = ProcessRequest(buffer, count, arena, offset, Storage::Pool::Request::Write);
+    // pinned spans must stay valid
+    if (arena.pins == 0)
+      Deduplicate(arena, first, first + static_cast<std::int64_t>(n));
+    return n;
   }
 
   std::int64_t Pool::Seek(Storage::Arena& arena, std::int64_t const offset) {
-    return arena.position = std::max<std::int64_t>(0LL, std::min<std::int64_t>(static_cast<std::int64_t>(arena.blocks.size()) * Storage::BLOCK_SIZEi64, offset));
+    return arena.position = std::max<std::int64_t>(0LL, std::min<std::int64_t>(arena.size, offset));
   }
 
   bool Pool::MoveToColdStorage(Storage::Arena& arena) {
-    return disk.Claim(arena, memory);
+    // pinned spans must stay where they are
+    if (arena.pins > 0)
+      return false;
+    Storage::Arena resident;
+    for (auto const& extent : arena.extents) {
+      if (extent.type == Storage::Type::Memory)
+        Storage::Append(resident, extent);
+    }
+    if (!disk.Claim(arena, memory))
+      return false;
+    Release(resident);
+    return true;
+  }
+
+  // moves all the cold storage of an arena to memory
+  bool Pool::Promote(Storage::Arena& arena) {
+    Storage::Arena cold, target;
+    for (auto const& extent : arena.extents) {
+      if (extent.type == Storage::Type::Disk)
+        Storage::Append(cold, extent);
+    }
+    if ((cold.size == 0) || !memory.Allocate(cold.size, target))
+      return false;
+    // copy the contents over, both sets of extents are in the same order
+    std::vector<std::uint8_t> buffer(static_cast<std::size_t>(std::min<std::int64_t>(cold.size, Storage::Pool::PROMOTION_CHUNK)));
+    auto destination = target.extents.begin();
+    std::int64_t consumed = 0;  // bytes of the current target extent already filled
+    for (auto const& extent : cold.extents) {
+      for (std::int64_t done = 0; done < extent.length;) {
+        std::size_t const length = static_cast<std::size_t>(std::min<std::int64_t>(std::min<std::int64_t>(extent.length - done, destination->length - consumed), static_cast<std::int64_t>(buffer.size())));
+        if (!disk.Read(extent.offset + done, buffer.data(), length)) {
+          memory.Deallocate(target);
+          return false;
+        }
+        memory.Write(destination->offset + consumed, buffer.data(), length);
+        done += static_cast<std::int64_t>(length);
+        if ((consumed += static_cast<std::int64_t>(length)) == destination->length) {
+          destination++;
+          consumed = 0;
+        }
+      }
+    }
+    Storage::Replace(arena, Storage::Type::Disk, target);
+    disk.Deallocate(cold);
+    return true;
+  }
+
+  // returns whether the resident storage of the arena was moved to compressed storage, which with
+  // deduplication doesn't necessarily free any memory, since its blocks may still be shared with other arenas
+  bool Pool::Compress(Storage::Arena& arena) {
+    if ((arena.pins > 0) || arena.incompressible)
+      return false;
+    Storage::Arena resident;
+    for (auto const& extent : arena.extents) {
+      if (extent.type == Storage::Type::Memory)
+        Storage::Append(resident, extent);
+    }
+    if ((resident.size == 0) || (!compressed.Claim(arena, memory)))
+      return false;
+    Release(resident);
+    return true;
+  }
+
+  std::int64_t Pool::Resident(Storage::Arena const& arena, Storage::Type const type) const {
+    std::int64_t size = 0;
+    for (auto const& extent : arena.extents) {
+      if (extent.type == type)
+        size += extent.length;
+    }
+    return size;
+  }
+
+  Storage::Span Pool::Pin(Storage::Arena& arena, std::int64_t const offset, std::size_t const count) {
+    if ((offset < 0) || (offset >= arena.size) || (count == 0))
+      return { nullptr, 0 };
+    std::int64_t index = offset;
+    Storage::Extent const& extent = arena.extents[Locate(arena, index)];
+    if (extent.type != Storage::Type::Memory)
+      return { nullptr, 0 };
+    // the span can cover up to the end of the extent
+    arena.pins++;
+    return { memory.Data(extent.offset + index), static_cast<std::size_t>(std::min<std::int64_t>(extent.length - index, static_cast<std::int64_t>(count))) };
+  }
+
+  void Pool::Unpin(Storage::Arena& arena) {
+    assert(arena.pins > 0);
+    arena.pins--;
   }
 
 }
\ No newline at end of file
@@ -23,31 +23,59 @@
 
 #include "memorycontainer.hpp"
 #include "diskcontainer.hpp"
+#include "compressedcontainer.hpp"
+#include <unordered_map>
 
 namespace Storage {
 
   class Pool final : public Storage::Holder {
   private:
+    static constexpr std::int64_t SMALL_SHARE = 16;  // requests up to this fraction of the memory tier are placed in memory whenever possible
+    static constexpr std::int64_t RESERVE_SHARE = 8;  // larger ones leave this fraction of it free for the smaller ones
+    static constexpr std::size_t PROMOTION_CHUNK = 64 * Storage::BLOCK_SIZE;  // amount of storage copied at once when promoting
     enum class Request { Read, Write };
     MemoryContainer memory;  // heap allocated storage
     DiskContainer disk;  // temporary physical storage
-    bool ReadBlock(Storage::Block& block, Storage::Buffer& buf);
-    bool WriteBlock(Storage::Block& block, Storage::Buffer& buf);
-    std::size_t ProcessRequest(void* buffer, std::size_t count, Storage::Arena& arena, Storage::Pool::Request const request);
+    CompressedContainer compressed;  // heap allocated storage for compressed blocks, only used for demotion
+    bool const deduplicate;  // set if memory blocks with identical contents are shared between arenas
+    std::vector<std::uint32_t> shares;  // for each memory block, the number of references to it besides the first
+    std::vector<std::uint64_t> hashes;  // for each memory block in the catalog, the hash of its contents
+    std::unordered_map<std::uint64_t, std::size_t> catalog;  // memory block holding the contents for each hash
+    std::mutex sharing;  // guards the deduplication state
+    static std::size_t Locate(Storage::Arena const& arena, std::int64_t& offset);
+    static void Remap(Storage::Arena& arena, std::int64_t const position, Storage::Extent const& block);
+    void Unindex(std::size_t const block);
+    void Release(Storage::Arena& arena);
+    bool Unshare(Storage::Arena& arena, std::int64_t const first, std::int64_t const last);
+    void Deduplicate(Storage::Arena& arena, std::int64_t const first, std::int64_t const last);
+    std::size_t ProcessRequest(void* buffer, std::size_t count, Storage::Arena const& arena, std::int64_t const offset, Storage::Pool::Request const request);
+    std::int64_t HotShare(std::int64_t const size) const;
   public:
-    Pool(std::int64_t const memory_size, std::int64_t const disk_size);
+    std::int64_t HotDemand(std::int64_t const size) const;
+    Pool(std::int64_t const memory_size, std::int64_t const disk_size, std::int64_t const compressed_size = 0, std::vector<std::string> const& directories = std::vector<std::string>(), bool const direct_io = false, bool const deduplicate = false);
     ~Pool();
     Pool(const Pool&) = delete;
     Pool& operator=(const Pool&) = delete;
     Pool(Pool&&) = delete;
     Pool& operator=(Pool&&) = delete;
-    std::unique_ptr<Storage::Arena> Allocate(std::int64_t size, Storage::AllocationStrategy const strategy = Storage::AllocationStrategy::None);
-    void Reallocate(Storage::Arena& arena, std::int64_t size, Storage::AllocationStrategy const strategy = Storage::AllocationStrategy::None);
+    Storage::Expected<std::unique_ptr<Storage::Arena>> Allocate(std::int64_t size, Storage::AllocationStrategy const strategy = Storage::AllocationStrategy::None);
+    bool Reallocate(Storage::Arena& arena, std::int64_t size, Storage::AllocationStrategy const strategy = Storage::AllocationStrategy::None);
     void Deallocate(Storage::Arena& arena);
+    void Truncate(Storage::Arena& arena, std::int64_t size);
     std::size_t Read(void* buffer, std::size_t count, Storage::Arena& arena);
     std::size_t Write(void* buffer, std::size_t count, Storage::Arena& arena);
+    std::size_t ReadAt(void* buffer, std::size_t count, Storage::Arena const& arena, std::int64_t const offset);
+    std::size_t WriteAt(void* buffer, std::size_t count, Storage::Arena& arena, std::int64_t const offset);
     std::int64_t Seek(Storage::Arena& arena, std::int64_t const offset);
     bool MoveToColdStorage(Storage::Arena& arena);
+    bool Promote(Storage::Arena& arena);
+    bool Compress(Storage::Arena& arena);
+    std::int64_t Resident(Storage::Arena const& arena, Storage::Type const type) const;
+    std::int64_t available() const override { return memory.available() + disk.available(); }
+    std::int64_t hot_capacity() const { return memory.capacity(); }
+    std::int64_t hot_available() const { return memory.available(); }
+    Storage::Span Pin(Storage::Arena& arena, std::int64_t const offset, std::size_t const count);
+    void Unpin(Storage::Arena& arena);
   };
 
 }  // namespace Storage
@@ -24,21 +24,51 @@
 #include "../common.hpp"
 #include <vector>
 #include <array>
+#include <string>
+#include <atomic>
+#include <cerrno>
 #ifndef MSC
 #  include <cstring>
 #endif
 #if _WIN32_WINNT >= 0x0501 // XP+
 #  include <io.h> // _get_osfhandle()
 #endif
+#ifdef WINDOWS
+#  include <io.h>
+#  include <fcntl.h>
+#  include <share.h>
+#  include <sys/stat.h>
+#else
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#endif
 
 namespace Storage {
 
-  enum class Type { Memory, Disk };
+  enum class Type { Memory, Disk, Compressed };
   enum class AllocationStrategy { None, Cold, Hot };
 
-  class Exhausted : public std::exception {};
+  class Exhausted : public std::exception {};  // only thrown when constructing storage, allocation reports it instead
   class Corrupted : public std::exception {};
 
+  enum class Error { None, Exhausted };
+
+  // An Expected holds either the result of an operation that may run out of storage, or the reason it failed
+  template<typename T>
+  class Expected {
+  private:
+    T value_;
+    Storage::Error error_;
+  public:
+    Expected(T value) : value_(std::move(value)), error_(Storage::Error::None) {}
+    Expected(Storage::Error const error) : value_(), error_(error) { assert(error != Storage::Error::None); }
+    explicit operator bool() const { return error_ == Storage::Error::None; }
+    Storage::Error error() const { return error_; }
+    T& value() { assert(error_ == Storage::Error::None); return value_; }
+    T& operator*() { return value(); }
+    T* operator->() { return &value(); }
+  };
+
   static constexpr std::size_t BLOCK_SIZE = 4096;
   static_assert(IS_POWER_OF_2(Storage::BLOCK_SIZE) && (Storage::BLOCK_SIZE >= 512), "Storage block size must be a power of 2, at least 512 (bytes)");
   static constexpr std::int64_t BLOCK_SIZEi64 = static_cast<std::int64_t>(Storage::BLOCK_SIZE);
@@ -50,79 +80,196 @@ namespace Storage {
 
   typedef std::array<uint8_t, Storage::BLOCK_SIZE> Buffer;
 
-  // A Block represents a single hybrid data storage block
-  typedef struct Block {
+  // allocator for memory aligned to the block size, as required for direct I/O
+  template<typename T>
+  struct AlignedAllocator {
+    typedef T value_type;
+    AlignedAllocator() = default;
+    template<typename U> AlignedAllocator(AlignedAllocator<U> const&) {}
+    T* allocate(std::size_t const n) {
+      void* p = nullptr;
+#ifdef WINDOWS
+      p = _aligned_malloc(n * sizeof(T), Storage::BLOCK_SIZE);
+#else
+      if (posix_memalign(&p, Storage::BLOCK_SIZE, n * sizeof(T)) != 0)
+        p = nullptr;
+#endif
+      if (p == nullptr)
+        throw std::bad_alloc();
+      return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) {
+#ifdef WINDOWS
+      _aligned_free(p);
+#else
+      std::free(p);
+#endif
+    }
+  };
+  template<typename T, typename U> bool operator==(AlignedAllocator<T> const&, AlignedAllocator<U> const&) { return true; }
+  template<typename T, typename U> bool operator!=(AlignedAllocator<T> const&, AlignedAllocator<U> const&) { return false; }
+
+  typedef std::vector<std::uint8_t, Storage::AlignedAllocator<std::uint8_t>> AlignedBuffer;
+
+  // An Extent is a run of physically contiguous hybrid data storage blocks
+  typedef struct Extent {
     Storage::Type type;
-    std::int64_t offset;
-  } Block;
+    std::int64_t offset;  // physical offset of the first block
+    std::int64_t length;  // size in bytes, always a multiple of the block size
+  } Extent;
 
   // An Arena is a fixed size hybrid data storage structure
   typedef struct Arena {
-    std::vector<Storage::Block*> blocks;  // storage for this arena
+    std::vector<Storage::Extent> extents;  // storage for this arena
+    std::int64_t size = 0;  // total size of all extents
     std::int64_t position = 0;  // relative position in this arena
+    std::uint32_t pins = 0;  // number of spans currently pinned over this arena
+    bool incompressible = false;  // set if compressing this arena wasn't worth it
   } Arena;
 
+  // appends an extent to an arena, merging it with the last one if they're physically adjacent
+  inline void Append(Storage::Arena& arena, Storage::Extent const& extent) {
+    assert((extent.length > 0) && ((extent.length & Storage::BLOCK_MASKi64) == 0));
+    if ((!arena.extents.empty()) && (arena.extents.back().type == extent.type) && (arena.extents.back().offset + arena.extents.back().length == extent.offset))
+      arena.extents.back().length += extent.length;
+    else
+      arena.extents.push_back(extent);
+    arena.size += extent.length;
+  }
+
+  // replaces, in order, every extent of the given type in an arena with the storage from the target arena
+  inline void Replace(Storage::Arena& arena, Storage::Type const type, Storage::Arena const& target) {
+    std::vector<Storage::Extent> extents;
+    extents.swap(arena.extents);
+    arena.size = 0;
+    auto destination = target.extents.begin();
+    std::int64_t consumed = 0;  // bytes of the current target extent already used
+    for (auto const& extent : extents) {
+      if (extent.type != type) {
+        Storage::Append(arena, extent);
+        continue;
+      }
+      for (std::int64_t done = 0; done < extent.length;) {
+        assert(destination != target.extents.end());
+        std::int64_t const bytes = std::min<std::int64_t>(destination->length - consumed, extent.length - done);
+        Storage::Append(arena, { destination->type, destination->offset + consumed, bytes });
+        done += bytes;
+        if ((consumed += bytes) == destination->length) {
+          destination++;
+          consumed = 0;
+        }
+      }
+    }
+    arena.extents.shrink_to_fit();
+  }
+
+  // A Span is a read-only view over contiguous memory-resident storage
+  typedef struct Span {
+    std::uint8_t const* data;
+    std::size_t size;
+  } Span;
+
+  // storage accounting can be read from any thread at any time, so it's kept in atomics
   class Holder {
   protected:
-    std::int64_t capacity_ = 0;
-    std::int64_t available_ = 0;
+    std::atomic<std::int64_t> capacity_{ 0 };
+    std::atomic<std::int64_t> available_{ 0 };
   public:
-    virtual const std::int64_t& capacity() const { return capacity_; }
-    virtual const std::int64_t& available() const { return available_; }
+    virtual std::int64_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+    virtual std::int64_t available() const { return available_.load(std::memory_order_relaxed); }
   };
 
-  inline std::FILE* GetTempFile(std::int64_t const size = 0) {
-    std::FILE* file = nullptr;
+  // creates an anonymous temporary file in the given directory (or the default one), returning its descriptor
+  inline Storage::Expected<int> GetTempFile(std::string const& directory = std::string()) {
+    int descriptor = -1;
 #ifdef WINDOWS
     wchar_t szTempFileName[MAX_PATH]{};
     wchar_t lpTempPathBuffer[MAX_PATH+1]{};
-    DWORD dwRetVal = GetTempPathW(MAX_PATH, lpTempPathBuffer);
-    if ((dwRetVal > MAX_PATH) || (dwRetVal == 0))
-      throw Storage::Exhausted();
+    if (directory.empty()) {
+      DWORD dwRetVal = GetTempPathW(MAX_PATH, lpTempPathBuffer);
+      if ((dwRetVal > MAX_PATH) || (dwRetVal == 0))
+        return Storage::Error::Exhausted;
+    }
+    else if (MultiByteToWideChar(CP_UTF8, 0, directory.c_str(), -1, lpTempPathBuffer, MAX_PATH) == 0)
+      return Storage::Error::Exhausted;
     if (GetTempFileNameW(lpTempPathBuffer, L"tmp", 0, szTempFileName) == 0)
-      throw Storage::Exhausted();
-    if (_wfopen_s(&file, szTempFileName, L"w+bRTD") != 0)
-      throw Storage::Exhausted();
+      return Storage::Error::Exhausted;
+    if (_wsopen_s(&descriptor, szTempFileName, _O_RDWR | _O_BINARY | _O_RANDOM | _O_SHORT_LIVED | _O_TEMPORARY, _SH_DENYRW, _S_IREAD | _S_IWRITE) != 0)
+      return Storage::Error::Exhausted;
 #else
-    file = tmpfile();
+    std::string path = directory;
+    if (path.empty()) {
+      char const* tmp = std::getenv("TMPDIR");
+      path = ((tmp != nullptr) && (*tmp != '\0')) ? tmp : "/tmp";
+    }
+#  ifdef O_TMPFILE
+    do {
+      descriptor = open(path.c_str(), O_TMPFILE | O_RDWR | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    } while ((descriptor < 0) && (errno == EINTR));
+#  endif
+    if (descriptor < 0) {
+      // no anonymous files on this system or filesystem, so create a named one and unlink it right away
+      std::string name = path + "/fairytale-XXXXXX";
+      std::vector<char> buffer(name.begin(), name.end());
+      buffer.push_back('\0');
+      descriptor = mkstemp(buffer.data());
+      if (descriptor >= 0)
+        unlink(buffer.data());
+    }
+    if (descriptor < 0)
+      return Storage::Error::Exhausted;
 #endif
-    if (file == nullptr)
-      throw Storage::Exhausted();
-    if (size > 0) {
-      // attempt to pre-allocate the required physical storage
-      if (fseeko(file, size-1, SEEK_SET) == 0) {
-        if (fputc('\0', file) != EOF)
-          fflush(file);
-      }
-      fseeko(file, 0, SEEK_END);
-      std::int64_t allocated = ftello(file);
-#if _WIN32_WINNT >= 0x0600 // Vista+
-      if (allocated < size) {
-        HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
-        FILE_ALLOCATION_INFO info;
-        info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
-        SetFileInformationByHandle(handle, FileAllocationInfo, &info, sizeof(info));
-        if (fseeko(file, size, SEEK_SET) == 0)
-          allocated = ftello(file);
-      }
+    return descriptor;
+  }
+
+  inline void CloseTempFile(int const descriptor) {
+#ifdef WINDOWS
+    _close(descriptor);
+#else
+    close(descriptor);
+#endif
+  }
+
+  // asks the OS not to cache a file's data, returns false if that isn't supported (on Linux, I/O must then be block aligned)
+  inline bool BypassCache(int const descriptor) {
+#if defined(LINUX) && defined(O_DIRECT)
+    int const flags = fcntl(descriptor, F_GETFL);
+    return (flags >= 0) && (fcntl(descriptor, F_SETFL, flags | O_DIRECT) == 0);
+#elif defined(F_NOCACHE)
+    return fcntl(descriptor, F_NOCACHE, 1) == 0;
+#else
+    (void)descriptor;
+    return false;
+#endif
+  }
+
+  // grows a file from its current size to the requested one, reserving the physical storage for it when possible
+  inline bool Grow(int const descriptor, std::int64_t const current, std::int64_t const size) {
+    assert(size > current);
+#ifdef WINDOWS
+#  if _WIN32_WINNT >= 0x0600 // Vista+
+    FILE_ALLOCATION_INFO info;
+    info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(reinterpret_cast<HANDLE>(_get_osfhandle(descriptor)), FileAllocationInfo, &info, sizeof(info));
+#  endif
+    (void)current;
+    return _chsize_s(descriptor, size) == 0;
+#else
+#  ifdef LINUX
+    int result;
+    do {
+      result = fallocate(descriptor, 0, static_cast<off_t>(current), static_cast<off_t>(size - current));
+    } while ((result != 0) && (errno == EINTR));
+    if (result == 0)
+      return true;
+    if ((errno != EOPNOTSUPP) && (errno != ENOSYS))
+      return false;
+#  else
+    (void)current;
+#  endif
+    // the filesystem can't reserve storage up front, so just extend the file
+    return ftruncate(descriptor, static_cast<off_t>(size)) == 0;
 #endif
-      if (allocated < size) {
-        // pre-allocation failed, try actually writing to the file (much slower)
-        Storage::Buffer const b{};
-        fseeko(file, 0, SEEK_SET);
-        allocated += static_cast<std::int64_t>(fwrite(&b, 1, Storage::BLOCK_SIZE-static_cast<std::size_t>(allocated & Storage::BLOCK_MASKi64), file));
-        assert((allocated & Storage::BLOCK_MASKi64) == 0);
-        while (allocated < size) {
-          std::size_t bytes = fwrite(&b, 1, b.size(), file);
-          allocated += static_cast<std::int64_t>(bytes);
-          if (bytes != b.size())
-            break;
-        }
-        if (allocated < size)
-          throw Storage::Exhausted();
-      }
-    }
-    return file;
   }
 
 }  // namespace Storage
@@ -20,12 +20,74 @@
 #include "filestream.hpp"
 #include "../storage/storage.hpp"
 #include "../misc/unicode.hpp"
+#include <cerrno>
+#ifndef WINDOWS
+#  include <unistd.h>
+#endif
 
 namespace Streams {
 
+  HandleCache::HandleCache(std::size_t const capacity) : capacity_(capacity) {}
+
+  // closes the least recently used files until within capacity, must be called with the lock held
+  void HandleCache::Trim() {
+    while (idle.size() > capacity_) {
+      Streams::FileStream* stream = idle.back();
+      idle.pop_back();
+      stream->parked = false;
+      stream->CloseHandle();
+    }
+  }
+
+  void HandleCache::Park(Streams::FileStream& stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stream.parked)
+      idle.erase(stream.slot);
+    stream.slot = idle.insert(idle.begin(), &stream);
+    stream.parked = true;
+    Trim();
+  }
+
+  // takes the stream out of the cache, returns false if it wasn't there, in which case its file may have been closed
+  bool HandleCache::Unpark(Streams::FileStream& stream) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!stream.parked)
+      return false;
+    idle.erase(stream.slot);
+    stream.parked = false;
+    return true;
+  }
+
+  void HandleCache::Resize(std::size_t const capacity) {
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity_ = capacity;
+    Trim();
+  }
+
+  std::size_t HandleCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return idle.size();
+  }
+
+  // never destroyed, since file streams with static storage duration may still use it while being destroyed at exit
+  Streams::HandleCache& HandleCache::Default() {
+    static Streams::HandleCache* cache = new Streams::HandleCache();
+    return *cache;
+  }
+
   FileStream::FileStream() {
     file = nullptr;
     name = nullptr;
+    leases = 0;
+    unflushed = false;
+    parked = false;
+  }
+
+  void FileStream::CloseHandle() {
+    if (file != nullptr)
+      fclose(file);
+    file = nullptr;
+    unflushed = false;
   }
 
   FileStream::~FileStream() {
@@ -36,7 +98,7 @@ namespace Streams {
     if (file != nullptr)
       return false;
     if (name != nullptr)
-      delete name;
+      delete[] name;
     std::size_t const len = std::strlen(filename) + 1;
     name = new char[len]();
     std::memcpy(name, filename, len);
@@ -48,11 +110,10 @@ namespace Streams {
   }
 
   void FileStream::Close() {
-    if (file != nullptr)
-      fclose(file);
+    Streams::HandleCache::Default().Unpark(*this);
+    CloseHandle();
     if (name != nullptr)
-      delete name;
-    file = nullptr;
+      delete[] name;
     name = nullptr;
   }
 
@@ -83,11 +144,12 @@ namespace Streams {
   }
 
   bool FileStream::Sleep() {
+    // out of the cache first, so it can't be closed under us meanwhile
+    Streams::HandleCache::Default().Unpark(*this);
     if (Dormant())
       return true;
     if (file != nullptr) {
-      fclose(file);
-      file = nullptr;
+      CloseHandle();
       return true;
     }
     return false;
@@ -113,6 +175,7 @@ namespace Streams {
   bool FileStream::PutByte(std::uint8_t const b) {
     if (file == nullptr)
       return false;
+    unflushed = true;
     return std::fputc(b, file) != EOF;
   }
 
@@ -125,7 +188,77 @@ namespace Streams {
   std::size_t FileStream::Write(void* buffer, std::size_t const count) {
     if (file == nullptr)
       return 0;
+    unflushed = true;
     return std::fwrite(buffer, 1, count, file);
   }
 
+  // uses pread where available, so the file can be read from several threads at once while nothing writes to it
+  std::size_t FileStream::ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if ((file == nullptr) || (offset < 0))
+      return 0;
+#ifdef WINDOWS
+    return Stream::ReadAt(buffer, count, offset);
+#else
+    if (unflushed) {
+      if (fflush(file) != 0)
+        return 0;
+      unflushed = false;
+    }
+    std::uint8_t* data = static_cast<std::uint8_t*>(buffer);
+    std::size_t n = 0;
+    while (n < count) {
+      ssize_t const bytes = pread(fileno(file), data + n, count - n, static_cast<off_t>(offset + static_cast<std::int64_t>(n)));
+      if (bytes > 0)
+        n += static_cast<std::size_t>(bytes);
+      else if ((bytes == 0) || (errno != EINTR))
+        break;
+    }
+    return n;
+#endif
+  }
+
+  std::size_t FileStream::WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if ((file == nullptr) || (offset < 0))
+      return 0;
+#ifdef WINDOWS
+    return Stream::WriteAt(buffer, count, offset);
+#else
+    if (unflushed) {
+      if (fflush(file) != 0)
+        return 0;
+      unflushed = false;
+    }
+    std::uint8_t const* data = static_cast<std::uint8_t const*>(buffer);
+    std::size_t n = 0;
+    while (n < count) {
+      ssize_t const bytes = pwrite(fileno(file), data + n, count - n, static_cast<off_t>(offset + static_cast<std::int64_t>(n)));
+      if (bytes > 0)
+        n += static_cast<std::size_t>(bytes);
+      else if ((bytes == 0) || (errno != EINTR))
+        break;
+    }
+    // anything read ahead into the stdio buffer may be stale now, seeking in place drops it
+    fseeko(file, ftello(file), SEEK_SET);
+    return n;
+#endif
+  }
+
+  // a file left open in the handle cache is used as is, otherwise it's reopened
+  bool FileStream::Acquire() {
+    if (leases == 0) {
+      Streams::HandleCache::Default().Unpark(*this);
+      if (!WakeUp())
+        return false;
+    }
+    leases++;
+    return true;
+  }
+
+  void FileStream::Relinquish() {
+    assert(leases > 0);
+    // only files that can be reopened by name are let go, and they're kept open until the cache needs room
+    if ((--leases == 0) && (name != nullptr) && (file != nullptr))
+      Streams::HandleCache::Default().Park(*this);
+  }
+
 }
\ No newline at end of file
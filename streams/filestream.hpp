@@ -22,13 +22,46 @@
 #define FILESTREAM_HPP
 
 #include "stream.hpp"
+#include <list>
+#include <mutex>
 
 namespace Streams {
 
+  static constexpr std::size_t MAX_CACHED_HANDLES = 128;  // default number of idle files kept open
+
+  class FileStream;
+
+  // Keeps the files of idle streams open, so leasing them again doesn't have to reopen them by name. Once there are
+  // too many, the least recently used ones are closed, so any number of files can be used with a bounded number of handles
+  class HandleCache {
+  private:
+    std::mutex mutex;
+    std::list<Streams::FileStream*> idle;  // most recently used first
+    std::size_t capacity_;
+    void Trim();
+  public:
+    explicit HandleCache(std::size_t const capacity = Streams::MAX_CACHED_HANDLES);
+    HandleCache(const HandleCache&) = delete;
+    HandleCache& operator=(const HandleCache&) = delete;
+    void Park(Streams::FileStream& stream);
+    bool Unpark(Streams::FileStream& stream);
+    void Resize(std::size_t const capacity);
+    std::size_t size();
+    std::size_t capacity() const { return capacity_; }
+    static Streams::HandleCache& Default();
+  };
+
   class FileStream : public Stream {
+    friend Streams::HandleCache;
+  private:
+    bool parked;  // set while idle in the handle cache, with the file still open
+    std::list<Streams::FileStream*>::iterator slot;  // position in the handle cache, valid while parked
+    void CloseHandle();
   protected:
     std::FILE* file;
     char* name;
+    std::uint32_t leases;  // the file is kept open while leased, and closed again once the last lease is gone
+    bool unflushed;  // set if writes may still be in the stdio buffer, which positional I/O bypasses
   public:
     FileStream();
     ~FileStream();
@@ -48,6 +81,10 @@ namespace Streams {
     bool PutByte(std::uint8_t const b);
     std::size_t Read(void* buffer, std::size_t const count);
     std::size_t Write(void* buffer, std::size_t const count);
+    std::size_t ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    std::size_t WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    bool Acquire() override;
+    void Relinquish() override;
   };
 
 }  // namespace Streams
@@ -22,14 +22,27 @@
 
 namespace Streams {
 
-  HybridStream::HybridStream(std::int64_t const size, std::shared_ptr<Storage::Pool> pool, Storage::AllocationStrategy const strategy) :
+  HybridStream::HybridStream(std::unique_ptr<Storage::Arena> storage, std::shared_ptr<Storage::Pool> pool) :
     pool(pool),
-    arena(pool->Allocate(size, strategy)),
-    reference_count(0),
-    priority(Streams::Priority::Normal),
-    keep_alive(false)
+    arena(std::move(storage)),
+    manager(nullptr),
+    heap(0),
+    index(Streams::HybridStream::NOT_INDEXED),
+    cost(0),
+    revive_cost_(Streams::UNKNOWN_REVIVE_COST),
+    policy{},
+    reference_count_(0),
+    priority_(Streams::Priority::Normal),
+    leases_(0),
+    growable_(false),
+    placement(Storage::AllocationStrategy::None),
+    cached(-1),
+    cached_size(0),
+    dirty(false),
+    restored_begin(0),
+    restored_end(INT64_MAX)
   {
-    capacity_ = available_ = arena->blocks.size() * Storage::BLOCK_SIZEi64;
+    capacity_ = available_ = arena->size;
   }
 
   HybridStream::~HybridStream() {
@@ -37,24 +50,90 @@ namespace Streams {
   }
 
   void HybridStream::Close() {
+    // the contents are gone, including any changes in the cursor, but the size is kept, since only part of them may be recreated
+    cached = -1;
+    dirty = false;
     pool->Deallocate(*arena);
-    available_ = 0;
   }
 
-  void HybridStream::Restore() {
+  bool HybridStream::Restore(Storage::AllocationStrategy const strategy) {
     if (Active())
-      return;
-    pool->Reallocate(*arena, capacity_, Storage::AllocationStrategy::Hot);
+      return true;
+    if (!pool->Reallocate(*arena, capacity_, strategy))
+      return false;
     arena->position = 0;
-    available_ = capacity_;
+    // nothing has been recreated yet
+    restored_begin = restored_end = 0;
+    return true;
+  }
+
+  void HybridStream::Update() {
+    if (manager != nullptr)
+      manager->Notify(*this);
   }
 
   bool HybridStream::CommitToDisk() {
     return pool->MoveToColdStorage(*arena);
   }
 
+  bool HybridStream::Compress() {
+    return pool->Compress(*arena);
+  }
+
+  // makes sure the cursor holds the block with the given position, returns false if it's past the end
+  bool HybridStream::Cache(std::int64_t const position) {
+    if ((cached >= 0) && (position >= cached) && (position < cached + static_cast<std::int64_t>(cached_size)))
+      return true;
+    if ((position >= arena->size) || (!Flush()))
+      return false;
+    if (cursor == nullptr) {
+      try {
+        cursor.reset(new Storage::Buffer());
+      }
+      catch (...) { return false; }
+    }
+    std::int64_t const start = position & ~Storage::BLOCK_MASKi64;
+    std::size_t const size = static_cast<std::size_t>(std::min<std::int64_t>(Storage::BLOCK_SIZEi64, arena->size - start));
+    bool const loaded = (pool->ReadAt(cursor->data(), size, *arena, start) == size);
+    arena->position = position;
+    cached = loaded ? start : -1;
+    cached_size = size;
+    return loaded;
+  }
+
+  // writes any changes made through byte I/O to the pool
+  bool HybridStream::Flush() {
+    if (!dirty)
+      return true;
+    bool const flushed = (pool->WriteAt(cursor->data(), cached_size, *arena, cached) == cached_size);
+    dirty = false;
+    return flushed;
+  }
+
+  // makes room for writing up to the given end position, if the stream is growable
+  bool HybridStream::Reserve(std::int64_t const end) {
+    std::int64_t const needed = end - capacity_;
+    if ((!growable_) || (needed <= 0) || (manager == nullptr))
+      return true;
+    if (!Active())
+      return false;
+    // grow geometrically up to a limit, but settle for just what's needed if that fails
+    std::int64_t const step = Storage::RoundToBlockMultiple(std::max<std::int64_t>(needed, std::min<std::int64_t>(capacity_, Streams::MAX_GROWTH_STEP)));
+    if ((!manager->Grow(*this, step)) && ((step == Storage::RoundToBlockMultiple(needed)) || !manager->Grow(*this, Storage::RoundToBlockMultiple(needed))))
+      return false;
+    std::int64_t const delta = arena->size - capacity_;
+    capacity_ += delta;
+    available_ += delta;
+    return true;
+  }
+
   bool HybridStream::Active() {
-    return arena->blocks.size() > 0;
+    return !arena->extents.empty();
+  }
+
+  // true if the given range holds the actual contents of the stream, and not just storage for them
+  bool HybridStream::Restored(std::int64_t const offset, std::int64_t const length) {
+    return Active() && (offset >= restored_begin) && (offset + length <= restored_end);
   }
 
   bool HybridStream::Seek(std::int64_t const offset) {
@@ -69,28 +148,150 @@ namespace Streams {
     return capacity_ - available_;
   }
 
+  // byte I/O goes through the cursor, so only crossing into another block reaches the pool
   int HybridStream::GetByte() {
-    std::uint8_t byte;
-    if (pool->Read(&byte, 1, *arena) != 1)
+    std::int64_t const position = arena->position;
+    if (!Cache(position))
       return EOF;
-    return static_cast<int>(byte);
+    arena->position++;
+    return static_cast<int>((*cursor)[static_cast<std::size_t>(position - cached)]);
   }
 
   bool HybridStream::PutByte(std::uint8_t const b) {
-    std::uint8_t byte = b;
-    std::size_t written = pool->Write(&byte, 1, *arena);
+    std::int64_t const position = arena->position;
+    if ((!Reserve(position + 1)) || (!Cache(position)))
+      return false;
+    (*cursor)[static_cast<std::size_t>(position - cached)] = b;
+    dirty = true;
+    arena->position++;
     available_ = std::min<std::int64_t>(available_, capacity_ - arena->position);
-    return written == 1;
+    return true;
   }
 
   std::size_t HybridStream::Read(void* buffer, std::size_t const count) {
+    if (!Flush())
+      return 0;
     return pool->Read(buffer, count, *arena);
   }
 
   std::size_t HybridStream::Write(void* buffer, std::size_t const count) {
+    if (!Flush())
+      return 0;
+    cached = -1;
+    if (!Reserve(arena->position + static_cast<std::int64_t>(count)))
+      return 0;
     std::size_t written = pool->Write(buffer, count, *arena);
     available_ = std::min<std::int64_t>(available_, capacity_ - arena->position);
     return written;
   }
 
+  // safe from several threads at once while leased and not being written to, so changes still in the cursor are
+  // copied over the result instead of being flushed
+  std::size_t HybridStream::ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    std::size_t const n = pool->ReadAt(buffer, count, *arena, offset);
+    if (dirty) {
+      std::int64_t const first = std::max<std::int64_t>(offset, cached), last = std::min<std::int64_t>(offset + static_cast<std::int64_t>(n), cached + static_cast<std::int64_t>(cached_size));
+      if (first < last)
+        std::memcpy(static_cast<std::uint8_t*>(buffer) + (first - offset), cursor->data() + (first - cached), static_cast<std::size_t>(last - first));
+    }
+    return n;
+  }
+
+  std::size_t HybridStream::WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if ((offset < 0) || (!Flush()))
+      return 0;
+    cached = -1;
+    if (!Reserve(offset + static_cast<std::int64_t>(count)))
+      return 0;
+    std::size_t written = pool->WriteAt(buffer, count, *arena, offset);
+    available_ = std::min<std::int64_t>(available_, capacity_ - (offset + static_cast<std::int64_t>(written)));
+    return written;
+  }
+
+  Streams::PinnedSpan HybridStream::Pin(std::int64_t const offset, std::size_t const count) {
+    if (!Flush())
+      return Streams::PinnedSpan();
+    // leased before pinning, so it can't be purged in between, the span then holds a lease of its own
+    Streams::Lease const lease(this);
+    Storage::Span const span = pool->Pin(*arena, offset, count);
+    if (span.size == 0)
+      return Streams::PinnedSpan();
+    return Streams::PinnedSpan(this, span.data, span.size);
+  }
+
+  void HybridStream::Unpin() {
+    pool->Unpin(*arena);
+  }
+
+  void HybridStream::AddReference() {
+    reference_count_++;
+    Update();
+  }
+
+  void HybridStream::RemoveReference() {
+    reference_count_ -= (reference_count_ > 0);
+    Update();
+  }
+
+  void HybridStream::SetPriority(Streams::Priority const priority) {
+    priority_ = priority;
+    Update();
+  }
+
+  // the first lease counts as a use of the stream, and is taken under the lock of the manager so purging can't race with it
+  bool HybridStream::Acquire() {
+    std::uint32_t leases = leases_.load();
+    while (leases > 0) {
+      if (leases_.compare_exchange_weak(leases, leases + 1))
+        return true;
+    }
+    if (manager != nullptr)
+      manager->Access(*this);
+    else
+      leases_++;
+    return true;
+  }
+
+  void HybridStream::Relinquish() {
+    assert(leases_ > 0);
+    if (--leases_ == 0)
+      Update();
+  }
+
+  void HybridStream::SetReviveCost(std::int64_t const cost) {
+    revive_cost_ = cost;
+    Update();
+  }
+
+  // records that a range of the contents has been recreated, extending the valid range if they overlap or touch
+  void HybridStream::SetRestored(std::int64_t const begin, std::int64_t const end) {
+    if ((begin <= restored_end) && (end >= restored_begin) && (restored_begin < restored_end)) {
+      restored_begin = std::min<std::int64_t>(restored_begin, begin);
+      restored_end = std::max<std::int64_t>(restored_end, end);
+    }
+    else {
+      restored_begin = begin;
+      restored_end = end;
+    }
+  }
+
+  // fixes the size of a growable stream to what has been written so far, giving back any storage left over,
+  // and fails without sealing it if the bytes still held by the cursor couldn't be written back
+  bool HybridStream::Seal() {
+    if (!growable_)
+      return true;
+    if (!Flush())
+      return false;
+    growable_ = false;
+    cached = -1;
+    std::int64_t const size = Size();
+    std::int64_t const capacity = std::max<std::int64_t>(Storage::BLOCK_SIZEi64, Storage::RoundToBlockMultiple(size));
+    if (Active() && (capacity < capacity_))
+      pool->Truncate(*arena, capacity);
+    capacity_ = capacity;
+    available_ = capacity_ - size;
+    Update();
+    return true;
+  }
+
 }
\ No newline at end of file
@@ -23,6 +23,7 @@
 
 #include "stream.hpp"
 #include "../storage/pool.hpp"
+#include "../storage/policy.hpp"
 
 namespace Storage {
   class Manager;
@@ -30,26 +31,51 @@ namespace Storage {
 
 namespace Streams {
 
+  static constexpr std::int64_t MAX_GROWTH_STEP = 0x100000;  // largest amount of storage a growable stream takes at once when it runs out
+  static constexpr std::int64_t UNKNOWN_REVIVE_COST = -1;  // for streams that were never given one, which are spilled rather than discarded
+
   class HybridStream final : public Stream, public Storage::Holder {
     friend Storage::Manager;
+    friend Storage::Policy;
   private:
+    static constexpr std::size_t NOT_INDEXED = SIZE_MAX;
     std::shared_ptr<Storage::Pool> const pool;
     std::unique_ptr<Storage::Arena> const arena;
-    HybridStream(std::int64_t const size, std::shared_ptr<Storage::Pool> pool, Storage::AllocationStrategy const strategy = Storage::AllocationStrategy::None);
+    Storage::Manager* manager;  // notified whenever anything that affects eviction changes
+    std::size_t heap;  // which eviction heap of the manager this stream is in
+    std::size_t index;  // position in that heap
+    std::int64_t cost;  // eviction cost, higher means evicted sooner
+    // read by the manager while purging on other threads
+    std::atomic<std::int64_t> revive_cost_;  // estimated cost of recreating the contents, relative to the cost of I/O per byte
+    Storage::Policy::Entry policy;  // bookkeeping for the eviction policy of the manager
+    std::atomic<std::uint32_t> reference_count_;
+    std::atomic<Streams::Priority> priority_;
+    std::atomic<std::uint32_t> leases_;  // the stream can't be purged while this is non-zero
+    bool growable_;  // set if writing past the end takes more storage from the pool, until the stream is sealed
+    Storage::AllocationStrategy placement;  // where the storage taken by the manager for the stream goes, when allocating and growing it
+    std::unique_ptr<Storage::Buffer> cursor;  // contents of the block being accessed by byte I/O, allocated on first use
+    std::int64_t cached;  // offset of the block in the cursor, or -1
+    std::size_t cached_size;  // number of valid bytes in the cursor
+    bool dirty;  // set if the cursor holds changes not yet written to the pool
+    std::int64_t restored_begin, restored_end;  // range of valid contents, only part of them may have been recreated after a revival
+    HybridStream(std::unique_ptr<Storage::Arena> storage, std::shared_ptr<Storage::Pool> pool);
     ~HybridStream();
     void Close();
-    void Restore();
+    bool Restore(Storage::AllocationStrategy const strategy);
     bool CommitToDisk();
+    bool Compress();
+    void Update();
+    bool Reserve(std::int64_t const end);
+    bool Cache(std::int64_t const position);
+    bool Flush();
+    void Unpin() override;
   public:
-    std::uint32_t reference_count;
-    Streams::Priority priority;
-    bool keep_alive;
-
     HybridStream(const HybridStream&) = delete;
     HybridStream& operator=(const HybridStream&) = delete;
     HybridStream(HybridStream&&) = delete;
     HybridStream& operator=(HybridStream&&) = delete;
     bool Active();
+    bool Restored(std::int64_t const offset, std::int64_t const length);
     bool Seek(std::int64_t const offset);
     std::int64_t Position();
     std::int64_t Size();
@@ -57,6 +83,22 @@ namespace Streams {
     bool PutByte(std::uint8_t const b);
     std::size_t Read(void* buffer, std::size_t const count);
     std::size_t Write(void* buffer, std::size_t const count);
+    std::size_t ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    std::size_t WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    Streams::PinnedSpan Pin(std::int64_t const offset, std::size_t const count) override;
+    bool Acquire() override;
+    void Relinquish() override;
+    std::uint32_t reference_count() const { return reference_count_; }
+    Streams::Priority priority() const { return priority_; }
+    bool leased() const { return leases_ > 0; }
+    std::int64_t revive_cost() const { return revive_cost_; }
+    bool growable() const { return growable_; }
+    void AddReference();
+    void RemoveReference();
+    void SetPriority(Streams::Priority const priority);
+    void SetReviveCost(std::int64_t const cost);
+    void SetRestored(std::int64_t const begin, std::int64_t const end);
+    bool Seal();
   };
 
 } // namespace Streams
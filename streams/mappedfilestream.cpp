@@ -0,0 +1,159 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "mappedfilestream.hpp"
+#include "../misc/unicode.hpp"
+#include <cstring>
+#ifndef WINDOWS
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace Streams {
+
+  MappedFileStream::MappedFileStream() {
+    view = nullptr;
+    length = 0;
+    position = 0;
+  }
+
+  MappedFileStream::~MappedFileStream() {
+    Close();
+  }
+
+  bool MappedFileStream::Open(char const* filename) {
+    if (view != nullptr)
+      return false;
+    length = position = 0;
+#ifdef WINDOWS
+    HANDLE const file = CreateFileW(widen(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER size;
+    bool result = (GetFileSizeEx(file, &size) != 0) && (static_cast<std::uint64_t>(size.QuadPart) <= SIZE_MAX);
+    // empty files can't be mapped, but there's nothing to read either
+    if (result && (size.QuadPart > 0)) {
+      HANDLE const mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping != nullptr) {
+        view = static_cast<std::uint8_t const*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);  // the view keeps the mapping alive
+      }
+      result = (view != nullptr);
+    }
+    CloseHandle(file);
+    if (result)
+      length = static_cast<std::int64_t>(size.QuadPart);
+    return result;
+#else
+    int const file = open(filename, O_RDONLY);
+    if (file < 0)
+      return false;
+    struct stat status;
+    bool result = (fstat(file, &status) == 0) && (static_cast<std::uint64_t>(status.st_size) <= SIZE_MAX);
+    // empty files can't be mapped, but there's nothing to read either
+    if (result && (status.st_size > 0)) {
+      void* const address = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+      if (address != MAP_FAILED) {
+        view = static_cast<std::uint8_t const*>(address);
+        // start reading it in the background, it's going to be scanned by every parser.
+        // it's not marked as sequential, since that lets the kernel drop pages as soon as they're read
+        madvise(address, static_cast<std::size_t>(status.st_size), MADV_WILLNEED);  // just a hint, failure is harmless
+      }
+      result = (view != nullptr);
+    }
+    // the mapping stays valid after the file is closed
+    close(file);
+    if (result)
+      length = static_cast<std::int64_t>(status.st_size);
+    return result;
+#endif
+  }
+
+  void MappedFileStream::Close() {
+    if (view != nullptr) {
+#ifdef WINDOWS
+      UnmapViewOfFile(view);
+#else
+      munmap(const_cast<std::uint8_t*>(view), static_cast<std::size_t>(length));
+#endif
+    }
+    view = nullptr;
+    length = position = 0;
+  }
+
+  bool MappedFileStream::Seek(std::int64_t const offset) {
+    if ((offset < 0) || (offset > length))
+      return false;
+    position = offset;
+    return true;
+  }
+
+  std::int64_t MappedFileStream::Position() {
+    return position;
+  }
+
+  std::int64_t MappedFileStream::Size() {
+    return length;
+  }
+
+  int MappedFileStream::GetByte() {
+    if (position >= length)
+      return EOF;
+    return view[position++];
+  }
+
+  bool MappedFileStream::PutByte(std::uint8_t const /*b*/) {
+    return false;
+  }
+
+  std::size_t MappedFileStream::Read(void* buffer, std::size_t const count) {
+    std::size_t const n = static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), length - position));
+    if (n > 0)
+      std::memcpy(buffer, view + position, n);
+    position += static_cast<std::int64_t>(n);
+    return n;
+  }
+
+  std::size_t MappedFileStream::Write(void* /*buffer*/, std::size_t const /*count*/) {
+    return 0;
+  }
+
+  // the mapping never changes while open, so this is safe from any number of threads
+  std::size_t MappedFileStream::ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if ((offset < 0) || (offset >= length))
+      return 0;
+    std::size_t const n = static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), length - offset));
+    std::memcpy(buffer, view + offset, n);
+    return n;
+  }
+
+  std::size_t MappedFileStream::WriteAt(void* /*buffer*/, std::size_t const /*count*/, std::int64_t const /*offset*/) {
+    return 0;
+  }
+
+  // the whole file is always in memory, so parsers can scan any part of it without copying
+  Streams::PinnedSpan MappedFileStream::Pin(std::int64_t const offset, std::size_t const count) {
+    if ((offset < 0) || (offset >= length))
+      return Streams::PinnedSpan();
+    return Streams::PinnedSpan(this, view + offset, static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), length - offset)));
+  }
+
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef MAPPEDFILESTREAM_HPP
+#define MAPPEDFILESTREAM_HPP
+
+#include "stream.hpp"
+
+namespace Streams {
+
+  // A read-only stream over a whole file mapped into memory, so seeking is free, reading is just copying from the page cache,
+  // and parsers can scan it in place
+  class MappedFileStream : public Stream {
+  protected:
+    std::uint8_t const* view;
+    std::int64_t length;
+    std::int64_t position;
+  public:
+    MappedFileStream();
+    ~MappedFileStream();
+    MappedFileStream(const MappedFileStream&) = delete;
+    MappedFileStream& operator=(const MappedFileStream&) = delete;
+    MappedFileStream(MappedFileStream&&) = delete;
+    MappedFileStream& operator=(MappedFileStream&&) = delete;
+    bool Open(char const* filename);
+    void Close();
+    bool Seek(std::int64_t const offset);
+    std::int64_t Position();
+    std::int64_t Size();
+    int GetByte();
+    bool PutByte(std::uint8_t const b);
+    std::size_t Read(void* buffer, std::size_t const count);
+    std::size_t Write(void* buffer, std::size_t const count);
+    std::size_t ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    std::size_t WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    Streams::PinnedSpan Pin(std::int64_t const offset, std::size_t const count) override;
+  };
+
+}  // namespace Streams
+
+#endif  // MAPPEDFILESTREAM_HPP
\ No newline at end of file
@@ -0,0 +1,103 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "slice.hpp"
+
+namespace Streams {
+
+  Slice::Slice(Streams::Stream* parent, std::int64_t const offset, std::int64_t const length) : parent(parent), offset(offset), length(length), position(0) {
+    assert((parent != nullptr) && (offset >= 0) && (length >= 0));
+  }
+
+  Slice& Slice::operator=(const Slice& other) {
+    parent = other.parent, offset = other.offset, length = other.length, position = other.position;
+    return *this;
+  }
+
+  bool Slice::Seek(std::int64_t const offset) {
+    if ((offset < 0) || (offset > length))
+      return false;
+    position = offset;
+    return true;
+  }
+
+  std::int64_t Slice::Position() {
+    return position;
+  }
+
+  std::int64_t Slice::Size() {
+    return length;
+  }
+
+  int Slice::GetByte() {
+    std::uint8_t b = 0;
+    if (ReadAt(&b, 1, position) != 1)
+      return EOF;
+    position++;
+    return b;
+  }
+
+  bool Slice::PutByte(std::uint8_t const b) {
+    std::uint8_t c = b;
+    if (WriteAt(&c, 1, position) != 1)
+      return false;
+    position++;
+    return true;
+  }
+
+  std::size_t Slice::Read(void* buffer, std::size_t const count) {
+    std::size_t const n = ReadAt(buffer, count, position);
+    position += static_cast<std::int64_t>(n);
+    return n;
+  }
+
+  std::size_t Slice::Write(void* buffer, std::size_t const count) {
+    std::size_t const n = WriteAt(buffer, count, position);
+    position += static_cast<std::int64_t>(n);
+    return n;
+  }
+
+  // offsets are relative to the start of the slice, and nothing past its end is ever touched
+  std::size_t Slice::ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if ((offset < 0) || (offset >= length))
+      return 0;
+    return parent->ReadAt(buffer, static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), length - offset)), this->offset + offset);
+  }
+
+  std::size_t Slice::WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if ((offset < 0) || (offset >= length))
+      return 0;
+    return parent->WriteAt(buffer, static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), length - offset)), this->offset + offset);
+  }
+
+  Streams::PinnedSpan Slice::Pin(std::int64_t const offset, std::size_t const count) {
+    if ((offset < 0) || (offset >= length))
+      return Streams::PinnedSpan();
+    return parent->Pin(this->offset + offset, static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), length - offset)));
+  }
+
+  bool Slice::Acquire() {
+    return parent->Acquire();
+  }
+
+  void Slice::Relinquish() {
+    parent->Relinquish();
+  }
+
+}
\ No newline at end of file
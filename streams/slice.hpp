@@ -0,0 +1,57 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef SLICE_HPP
+#define SLICE_HPP
+
+#include "stream.hpp"
+
+namespace Streams {
+
+  // A view over a range of another stream, with its own position, so it never moves the cursor of the parent. It only
+  // uses positional I/O on the parent, so slices of a stream that nothing writes to can be used from several threads
+  class Slice : public Stream {
+  protected:
+    Streams::Stream* parent;
+    std::int64_t offset;
+    std::int64_t length;
+    std::int64_t position;
+  public:
+    Slice(Streams::Stream* parent, std::int64_t const offset, std::int64_t const length);
+    // slices hold no data, so they're cheap to copy and hand around
+    Slice(const Slice& other) : Stream(), parent(other.parent), offset(other.offset), length(other.length), position(other.position) {}
+    Slice& operator=(const Slice& other);
+    bool Seek(std::int64_t const offset);
+    std::int64_t Position();
+    std::int64_t Size();
+    int GetByte();
+    bool PutByte(std::uint8_t const b);
+    std::size_t Read(void* buffer, std::size_t const count);
+    std::size_t Write(void* buffer, std::size_t const count);
+    std::size_t ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    std::size_t WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    Streams::PinnedSpan Pin(std::int64_t const offset, std::size_t const count) override;
+    bool Acquire() override;
+    void Relinquish() override;
+  };
+
+}  // namespace Streams
+
+#endif  // SLICE_HPP
\ No newline at end of file
@@ -0,0 +1,136 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "spoolstream.hpp"
+#include "../storage/manager.hpp"
+
+namespace Streams {
+
+  // the source isn't owned, and is read sequentially from its current position
+  SpoolStream::SpoolStream(std::FILE* source, Storage::Manager& manager) : source(source), manager(&manager), position(0), exhausted(false), failed(false) {
+    storage = manager.Allocate(static_cast<std::int64_t>(Streams::SPOOL_CHUNK), true, &lease);
+    if (storage == nullptr) {
+      failed = true;
+      Finish();
+    }
+    else
+      storage->SetPriority(Streams::Priority::High);
+  }
+
+  SpoolStream::~SpoolStream() {
+    lease.Release();
+    if (storage != nullptr)
+      manager->Delete(storage);
+  }
+
+  void SpoolStream::Finish() {
+    exhausted = true;
+    // give back whatever storage we took ahead of time
+    if ((storage != nullptr) && (!storage->Seal()))
+      failed = true;
+  }
+
+  // reads up to the given number of bytes from the source into storage, returns how many were spooled
+  std::size_t SpoolStream::Ingest(std::size_t const count) {
+    Storage::Buffer buffer;
+    std::size_t total = 0;
+    while ((!exhausted) && (total < count)) {
+      std::size_t const n = std::fread(&buffer[0], 1, std::min<std::size_t>(buffer.size(), count - total), source);
+      if (n == 0) {
+        Finish();
+        break;
+      }
+      if (storage->WriteAt(&buffer[0], n, storage->Size()) != n) {
+        failed = true;
+        Finish();
+        break;
+      }
+      total += n;
+    }
+    return total;
+  }
+
+  // spools until the given end position is available, returns false if the source ends before it
+  bool SpoolStream::Ensure(std::int64_t const end) {
+    while ((Size() < end) && (!exhausted))
+      Ingest(static_cast<std::size_t>(std::max<std::int64_t>(end - Size(), static_cast<std::int64_t>(Streams::SPOOL_CHUNK))));
+    return Size() >= end;
+  }
+
+  bool SpoolStream::Seek(std::int64_t const offset) {
+    if ((offset < 0) || !Ensure(offset))
+      return false;
+    position = offset;
+    return true;
+  }
+
+  std::int64_t SpoolStream::Position() {
+    return position;
+  }
+
+  std::int64_t SpoolStream::Size() {
+    return (storage != nullptr) ? storage->Size() : 0;
+  }
+
+  int SpoolStream::GetByte() {
+    std::uint8_t b = 0;
+    if (ReadAt(&b, 1, position) != 1)
+      return EOF;
+    position++;
+    return b;
+  }
+
+  bool SpoolStream::PutByte(std::uint8_t const /*b*/) {
+    return false;
+  }
+
+  std::size_t SpoolStream::Read(void* buffer, std::size_t const count) {
+    std::size_t const n = ReadAt(buffer, count, position);
+    position += static_cast<std::int64_t>(n);
+    return n;
+  }
+
+  std::size_t SpoolStream::Write(void* /*buffer*/, std::size_t const /*count*/) {
+    return 0;
+  }
+
+  // only safe from several threads at once within the data already spooled, since reading past it pulls from the source
+  std::size_t SpoolStream::ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    if (offset < 0)
+      return 0;
+    Ensure(offset + static_cast<std::int64_t>(count));
+    std::int64_t const size = Size();
+    if (offset >= size)
+      return 0;
+    return storage->ReadAt(buffer, static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), size - offset)), offset);
+  }
+
+  std::size_t SpoolStream::WriteAt(void* /*buffer*/, std::size_t const /*count*/, std::int64_t const /*offset*/) {
+    return 0;
+  }
+
+  // never spools more, parsers fall back to reading if the span is empty
+  Streams::PinnedSpan SpoolStream::Pin(std::int64_t const offset, std::size_t const count) {
+    std::int64_t const size = Size();
+    if ((offset < 0) || (offset >= size))
+      return Streams::PinnedSpan();
+    return storage->Pin(offset, static_cast<std::size_t>(std::min<std::int64_t>(static_cast<std::int64_t>(count), size - offset)));
+  }
+
+}
\ No newline at end of file
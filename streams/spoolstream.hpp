@@ -0,0 +1,74 @@
+/*
+  This file is part of the Fairytale project
+
+  Copyright (C) 2021 Márcio Pais
+
+  This library is free software: you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#ifndef SPOOLSTREAM_HPP
+#define SPOOLSTREAM_HPP
+
+#include "stream.hpp"
+#include "hybridstream.hpp"
+
+namespace Storage {
+  class Manager;
+}
+
+namespace Streams {
+
+  static constexpr std::size_t SPOOL_CHUNK = 0x100000;  // default amount read from the source at once
+
+  // A read-only stream over a source that can't seek, like a pipe or stdin. Everything read from the source is kept in
+  // storage from the manager, so parsers can look back and seek anywhere already spooled, and reading past that pulls in
+  // more from the source. Until the source is exhausted Size() is the amount spooled so far, so blocks can be analysed
+  // as each chunk arrives, instead of waiting for the whole input
+  class SpoolStream : public Stream {
+  protected:
+    std::FILE* source;
+    Storage::Manager* manager;
+    Streams::HybridStream* storage;
+    Streams::Lease lease;  // the spooled data can't be recreated, so it must never be purged
+    std::int64_t position;
+    bool exhausted;  // set once the source has nothing more to give
+    bool failed;  // set if we ran out of storage, in which case anything past the spooled data is lost
+    void Finish();
+    bool Ensure(std::int64_t const end);
+  public:
+    SpoolStream(std::FILE* source, Storage::Manager& manager);
+    ~SpoolStream();
+    SpoolStream(const SpoolStream&) = delete;
+    SpoolStream& operator=(const SpoolStream&) = delete;
+    SpoolStream(SpoolStream&&) = delete;
+    SpoolStream& operator=(SpoolStream&&) = delete;
+    std::size_t Ingest(std::size_t const count = Streams::SPOOL_CHUNK);
+    bool Exhausted() const { return exhausted; }
+    bool Failed() const { return failed; }
+    bool Seek(std::int64_t const offset);
+    std::int64_t Position();
+    std::int64_t Size();
+    int GetByte();
+    bool PutByte(std::uint8_t const b);
+    std::size_t Read(void* buffer, std::size_t const count);
+    std::size_t Write(void* buffer, std::size_t const count);
+    std::size_t ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    std::size_t WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) override;
+    Streams::PinnedSpan Pin(std::int64_t const offset, std::size_t const count) override;
+  };
+
+}  // namespace Streams
+
+#endif  // SPOOLSTREAM_HPP
\ No newline at end of file
@@ -27,7 +27,12 @@ namespace Streams {
 
   enum class Priority { High = 1, Normal, Low };
 
+  class PinnedSpan;
+
   class Stream {
+    friend Streams::PinnedSpan;
+  protected:
+    virtual void Unpin() {}
   public:
     Stream() = default;
     Stream(const Stream&) = delete;
@@ -41,8 +46,101 @@ namespace Streams {
     virtual int GetByte() = 0;
     virtual std::size_t Read(void* buffer, std::size_t const count) = 0;
     virtual std::size_t Write(void* buffer, std::size_t const count) = 0;
+    // positional I/O, leaves the current position untouched. Overrides may be used from several threads at once while nothing
+    // writes to the stream, the default just seeks there and back, so it's only as safe as Seek and Read
+    virtual std::size_t ReadAt(void* buffer, std::size_t const count, std::int64_t const offset);
+    virtual std::size_t WriteAt(void* buffer, std::size_t const count, std::int64_t const offset);
+    // leases are counted, and a stream stays available while any is held, returns false if it can't be made available
+    virtual bool Acquire() { return true; }
+    virtual void Relinquish() {}
+    // streams with their contents in memory can expose them to be scanned in place, otherwise the span is empty
+    virtual Streams::PinnedSpan Pin(std::int64_t const offset, std::size_t const count);
+  };
+
+  // A Lease keeps a stream available for use until it goes out of scope, so it can't be purged or put to sleep meanwhile
+  class Lease {
+  private:
+    Streams::Stream* stream;
+  public:
+    Lease() : stream(nullptr) {}
+    explicit Lease(Streams::Stream* stream) : stream(((stream != nullptr) && stream->Acquire()) ? stream : nullptr) {}
+    ~Lease() { Release(); }
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease(Lease&& other) : stream(other.stream) { other.stream = nullptr; }
+    Lease& operator=(Lease&& other) {
+      if (this != &other) {
+        Release();
+        stream = other.stream;
+        other.stream = nullptr;
+      }
+      return *this;
+    }
+    void Release() {
+      if (stream != nullptr)
+        stream->Relinquish();
+      stream = nullptr;
+    }
+    explicit operator bool() const { return stream != nullptr; }
+  };
+
+  // A PinnedSpan is a read-only view over stream data in memory, which can't be purged or moved while held
+  class PinnedSpan {
+  private:
+    Streams::Stream* stream;
+    std::uint8_t const* data_;
+    std::size_t size_;
+    Streams::Lease lease;  // keeps the stream from being purged while pinned
+  public:
+    PinnedSpan() : stream(nullptr), data_(nullptr), size_(0) {}
+    PinnedSpan(Streams::Stream* stream, std::uint8_t const* data, std::size_t const size) : stream(stream), data_(data), size_(size), lease(stream) {}
+    ~PinnedSpan() { Release(); }
+    PinnedSpan(const PinnedSpan&) = delete;
+    PinnedSpan& operator=(const PinnedSpan&) = delete;
+    PinnedSpan(PinnedSpan&& other) : stream(other.stream), data_(other.data_), size_(other.size_), lease(std::move(other.lease)) {
+      other.stream = nullptr;
+      other.data_ = nullptr, other.size_ = 0;
+    }
+    PinnedSpan& operator=(PinnedSpan&& other) {
+      if (this != &other) {
+        Release();
+        stream = other.stream, data_ = other.data_, size_ = other.size_, lease = std::move(other.lease);
+        other.stream = nullptr;
+        other.data_ = nullptr, other.size_ = 0;
+      }
+      return *this;
+    }
+    void Release() {
+      if (stream == nullptr)
+        return;
+      stream->Unpin();
+      lease.Release();
+      stream = nullptr;
+      data_ = nullptr, size_ = 0;
+    }
+    std::uint8_t const* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    explicit operator bool() const { return stream != nullptr; }
   };
 
+  inline std::size_t Stream::ReadAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    std::int64_t const position = Position();
+    std::size_t const n = Seek(offset) ? Read(buffer, count) : 0;
+    Seek(position);
+    return n;
+  }
+
+  inline std::size_t Stream::WriteAt(void* buffer, std::size_t const count, std::int64_t const offset) {
+    std::int64_t const position = Position();
+    std::size_t const n = Seek(offset) ? Write(buffer, count) : 0;
+    Seek(position);
+    return n;
+  }
+
+  inline Streams::PinnedSpan Stream::Pin(std::int64_t const /*offset*/, std::size_t const /*count*/) {
+    return Streams::PinnedSpan();
+  }
+
 }  // namespace Streams
 
 #endif  // STREAM_HPP
\ No newline at end of file
@@ -23,12 +23,22 @@
 
 #include "common.hpp"
 #include <array>
+#include <vector>
 
 namespace zLib {
   static constexpr std::size_t MAX_PENALTY_BYTES = 64;
+  static constexpr std::size_t WINDOW_SIZE = 0x8000;  // largest distance a deflate stream can refer back to
 }
 
 namespace Structures {
+  // a point from where inflating can resume, without starting from the beginning of the stream
+  typedef struct DeflateCheckpoint {
+    std::int64_t input;  // offset of the first whole byte of the next deflate block
+    std::int64_t output;  // offset in the uncompressed data
+    int bits;  // number of bits of the previous byte that belong to the next deflate block
+    std::array<std::uint8_t, zLib::WINDOW_SIZE> window;  // uncompressed data right before this point
+  } DeflateCheckpoint;
+
   typedef struct DeflateInfo {
     struct {
       int parameters;
@@ -40,6 +50,7 @@ namespace Structures {
     std::array<std::int64_t, zLib::MAX_PENALTY_BYTES> differ_positions;
     std::int64_t compressed_length;
     std::int64_t uncompressed_length;
+    std::vector<Structures::DeflateCheckpoint>* checkpoints;  // recorded when reviving the stream, owned by the block
   } DeflateInfo;
 
   typedef struct ImageInfo {
@@ -73,15 +73,17 @@ void DeflateTransform::SetupParameters(Structures::DeflateInfo& data) {
   main_return = Z_STREAM_END;
 }
 
-bool DeflateTransform::AttemptBlockRecompression(std::int64_t const base, std::int64_t const length, std::size_t const id) {
+// the length of the deflate stream is only known once it's been fully inflated, so only then is the recompressed stream finished
+bool DeflateTransform::AttemptBlockRecompression(std::int64_t const base, std::size_t const id) {
   trials++;
+  bool const last = (main_return == Z_STREAM_END);
   // update the recompressed stream buffer information
   recompressed_streams[id].next_in   = &output_block[0];
   recompressed_streams[id].avail_in  = static_cast<uInt>(zLib::BLOCK_SIZE - main_stream.avail_out);
   recompressed_streams[id].next_out  = &recompressed_block[recompressed_block_positions[id]];
   recompressed_streams[id].avail_out = static_cast<uInt>(zLib::BLOCK_SIZE * 2 - recompressed_block_positions[id]);
   // now deflate/recompress it
-  int ret = deflate(&recompressed_streams[id], (total_in == length) ? Z_FINISH : Z_NO_FLUSH);
+  int ret = deflate(&recompressed_streams[id], last ? Z_FINISH : Z_NO_FLUSH);
   if ((ret != Z_BUF_ERROR) && (ret != Z_STREAM_END) && (ret != Z_OK)) {
     differ_counts[id] = zLib::MAX_PENALTY_BYTES;
     return false;
@@ -92,7 +94,7 @@ bool DeflateTransform::AttemptBlockRecompression(std::int64_t const base, std::i
   std::int64_t const new_total_out = static_cast<std::int64_t>(recompressed_streams[id].total_out), total_out_low = recompressed_streams_sizes[id] & ULONG_MASK;
   recompressed_streams_sizes[id] += ((total_out_low <= new_total_out) ? new_total_out : 0x100000000LL + new_total_out) - total_out_low;
 
-  std::size_t tail = static_cast<std::size_t>(std::max<std::int64_t>((main_return == Z_STREAM_END) ?length - recompressed_streams_sizes[id] : 0LL, 0LL));
+  std::size_t tail = static_cast<std::size_t>(std::max<std::int64_t>(last ? total_in - recompressed_streams_sizes[id] : 0LL, 0LL));
   std::size_t i = recompressed_block_positions[id];
 
   std::uint_fast64_t* pRec = reinterpret_cast<std::uint_fast64_t*>(&recompressed_block[i]);
@@ -104,7 +106,7 @@ bool DeflateTransform::AttemptBlockRecompression(std::int64_t const base, std::i
   std::int64_t offset = base + static_cast<std::int64_t>(i) - zLib::BLOCK_SIZEi64;
   assert(offset >= 0);
   for (; i < end; i++, offset++) {
-    if ((offset < length) && (recompressed_block[i] != input_block[i])) {
+    if (((!last) || (offset < total_in)) && (recompressed_block[i] != input_block[i])) {
       if (++differ_counts[id] < zLib::MAX_PENALTY_BYTES) {
         std::size_t const position = id * zLib::MAX_PENALTY_BYTES + differ_counts[id];
         differ_positions[position] = offset;
@@ -132,12 +134,31 @@ bool DeflateTransform::AttemptBlockRecompression(std::int64_t const base, std::i
   return true;
 }
 
+// saves what's needed to resume inflating from the current position: the input offset, any bits of the previous byte still to be used, and the window
+void DeflateTransform::Checkpoint(std::vector<Structures::DeflateCheckpoint>& checkpoints, z_stream const& stream, std::int64_t const input, std::int64_t const output) {
+  assert(output >= static_cast<std::int64_t>(zLib::WINDOW_SIZE));
+  try {
+    checkpoints.emplace_back();
+  }
+  catch (...) { return; }  // resume points are just an optimization
+  Structures::DeflateCheckpoint& checkpoint = checkpoints.back();
+  checkpoint.input = input;
+  checkpoint.output = output;
+  checkpoint.bits = stream.data_type & 7;
+  // unroll the circular buffer, oldest data first
+  std::size_t const start = static_cast<std::size_t>(output % static_cast<std::int64_t>(zLib::WINDOW_SIZE));
+  std::memcpy(&checkpoint.window[0], &window[start], zLib::WINDOW_SIZE - start);
+  std::memcpy(&checkpoint.window[zLib::WINDOW_SIZE - start], &window[0], start);
+}
+
 Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage::Manager& manager, void* info) {
   if (info == nullptr)
     return nullptr;
   Structures::DeflateInfo* data = reinterpret_cast<Structures::DeflateInfo*>(info);
-  if (data->compressed_length > manager.capacity())
-    return nullptr;
+  // any resume points belong to the block of the previous stream
+  data->checkpoints = nullptr;
+  // the stream is inflated up to its end, which tells us its length, so the input may extend past it
+  data->compressed_length = data->uncompressed_length = 0;
   ClearBuffers();
   if (zLib::InflateInit(&main_stream, data->zLib.parameters) != Z_OK)
     return nullptr;
@@ -145,11 +166,15 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
   std::int64_t const initial_position = input.Position();
   std::size_t index = SIZE_MAX;  // zlib combination used
   bool found = false;
+  std::int64_t inflated = 0;  // uncompressed bytes so far
+  // the output is written as it's inflated during the trials, to a stream that grows as needed. It's leased so it isn't purged
+  // meanwhile, and only takes free storage, cold storage first, so other streams are never purged for a candidate that may be rejected
+  Streams::Lease lease;
+  Streams::HybridStream* output = manager.Allocate(zLib::BLOCK_SIZEi64, true, &lease, Storage::AllocationStrategy::Cold);
+  bool streaming = (output != nullptr);
 
-  for (std::int64_t offset = 0; offset < data->compressed_length; offset += zLib::BLOCK_SIZEi64) {  // stream offset
+  for (std::int64_t offset = 0; ; offset += zLib::BLOCK_SIZEi64) {  // stream offset
     assert(offset == total_in);
-    // amount of data to read this iteration
-    std::size_t block_size = static_cast<std::size_t>(std::min<std::int64_t>(data->compressed_length - offset, zLib::BLOCK_SIZEi64));
     // see how many trials we need to run
     trials = 0;
     for (std::size_t j = 0; j < zLib::POSSIBLE_COMBINATIONS; j++) {
@@ -166,8 +191,9 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
     // rotate block contents
     std::memmove(&recompressed_block[0], &recompressed_block[zLib::BLOCK_SIZE], zLib::BLOCK_SIZE);
     std::memmove(&input_block[0], &input_block[zLib::BLOCK_SIZE], zLib::BLOCK_SIZE);
-    // finish filling the input block with data from the input stream
-    if (input.Read(&input_block[zLib::BLOCK_SIZE], block_size) != block_size)
+    // finish filling the input block with data from the input stream, which may go past the end of the deflate stream
+    std::size_t const block_size = input.Read(&input_block[zLib::BLOCK_SIZE], zLib::BLOCK_SIZE);
+    if (block_size == 0)
       break;
     // see if we can switch to skip mode
     if ((!skip_mode.active) && (offset >= skip_mode.threshold) && (trials > 1)) {
@@ -176,6 +202,7 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
         std::memmove(&skip_mode.saved.recompressed_block[0], &recompressed_block[0], zLib::BLOCK_SIZE);
         skip_mode.saved.main_return = main_return;
         skip_mode.saved.offset = offset;
+        skip_mode.saved.output_position = inflated;
         skip_mode.threshold += zLib::BLOCK_SIZEi64;
         for (skip_mode.id = MTF.First(); (skip_mode.id != SIZE_MAX) && (differ_counts[skip_mode.id] >= zLib::MAX_PENALTY_BYTES); skip_mode.id = MTF.Next());
         assert(skip_mode.id != SIZE_MAX);
@@ -194,9 +221,13 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
       // update total input bytes used, taking care to handle 32-bit overflows
       std::int64_t const new_total_in = static_cast<std::int64_t>(main_stream.total_in), total_in_low = total_in & ULONG_MASK;
       total_in += ((total_in_low <= new_total_in) ? new_total_in : 0x100000000LL + new_total_in) - total_in_low;
+      std::size_t const count = zLib::BLOCK_SIZE - static_cast<std::size_t>(main_stream.avail_out);
+      inflated += static_cast<std::int64_t>(count);
+      if (streaming)
+        streaming = (output->Write(&output_block[0], count) == count);
 
       if (skip_mode.active) {
-        if (!AttemptBlockRecompression(offset, data->compressed_length, skip_mode.id)) {
+        if (!AttemptBlockRecompression(offset, skip_mode.id)) {
           // this combination has failed to fully recreate the stream, so we must resume trying available combinations
           skip_mode.active = false;
           inflateEnd(&main_stream);
@@ -215,6 +246,9 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
           main_return = skip_mode.saved.main_return;
           offset = skip_mode.saved.offset - zLib::BLOCK_SIZEi64;  // offset will now be incremented in the for loop, so account for that
           total_in = skip_mode.saved.offset;
+          // the output will be the same when inflated again
+          inflated = skip_mode.saved.output_position;
+          streaming = streaming && output->Seek(inflated);
         }
         else if (main_return == Z_STREAM_END) {
           std::size_t const count = differ_counts[skip_mode.id];
@@ -244,7 +278,7 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
               continue;
             }
           }
-          if (!AttemptBlockRecompression(offset, data->compressed_length, j))
+          if (!AttemptBlockRecompression(offset, j))
             continue;
           // early break on perfect match
           else if ((main_return == Z_STREAM_END) && (differ_counts[j] == 0)) {
@@ -255,8 +289,8 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
         }
       }
     } while ((main_stream.avail_out == 0) && (main_return == Z_BUF_ERROR) && (trials > 0));
-    // we're done with this input block
-    if (((main_return != Z_BUF_ERROR) && (main_return != Z_STREAM_END)) || (trials == 0))
+    // we're done with this input block, and with the stream once it has been fully inflated
+    if ((main_return != Z_BUF_ERROR) || (trials == 0))
       break;
   }
 
@@ -277,11 +311,19 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
         min_differ_count = differ_counts[index = i];
     }
   }
+  // without reaching the end of the stream, its length isn't known
+  bool const complete = (main_return == Z_STREAM_END);
   inflateEnd(&main_stream);
-  if (min_differ_count >= zLib::MAX_PENALTY_BYTES)
+  if ((min_differ_count >= zLib::MAX_PENALTY_BYTES) || (!complete)) {
+    lease.Release();
+    if (output != nullptr)
+      manager.Delete(output);
     return nullptr;
+  }
 
   // save reconstruction info
+  data->compressed_length = total_in;
+  data->uncompressed_length = inflated;
   data->penalty_bytes_count = min_differ_count;
   data->zLib.combination = static_cast<std::uint8_t>(index);
   std::size_t offset = index * zLib::MAX_PENALTY_BYTES;
@@ -295,21 +337,31 @@ Streams::HybridStream* DeflateTransform::Attempt(Streams::Stream& input, Storage
     data->penalty_bytes[i] = penalty_bytes[offset];
 
   // validate detection
-  if (!Validate(*data))
+  if (!Validate(*data)) {
+    lease.Release();
+    if (output != nullptr)
+      manager.Delete(output);
     return nullptr;
+  }
   MTF.Update(index);
-  // now try to output the decompressed stream
-  if (!input.Seek(initial_position))
-    return nullptr;
-  Streams::HybridStream* output = manager.Allocate(data->uncompressed_length);
-  if (output == nullptr)
-    return output;
-  if (!Apply(input, *output, info)) {
-    manager.Delete(output);
-    return nullptr;
+  if (!(streaming && (output->Size() == data->uncompressed_length) && output->Seal() && input.Seek(initial_position + data->compressed_length))) {
+    // the output couldn't be kept while inflating, so decompress the stream again
+    lease.Release();
+    if (output != nullptr)
+      manager.Delete(output);
+    if (!input.Seek(initial_position))
+      return nullptr;
+    output = manager.Allocate(data->uncompressed_length);
+    if (output == nullptr)
+      return output;
+    if (!Apply(input, *output, info)) {
+      manager.Delete(output);
+      return nullptr;
+    }
   }
-  else
-    return output;
+  // reviving it means reading the input again and inflating it
+  output->SetReviveCost(data->compressed_length + data->uncompressed_length * zLib::INFLATE_COST);
+  return output;
 }
 
 bool DeflateTransform::Apply(Streams::Stream& input, Streams::Stream& output, void* info) {
@@ -321,6 +373,12 @@ bool DeflateTransform::Apply(Streams::Stream& input, Streams::Stream& output, vo
   int ret = zLib::InflateInit(&stream, data->zLib.parameters);
   if (ret != Z_OK)
     return false;
+  // if the block keeps resume points, record them as we go, stopping at the end of every deflate block to check
+  std::vector<Structures::DeflateCheckpoint>* const checkpoints = data->checkpoints;
+  if (checkpoints != nullptr)
+    checkpoints->clear();
+  int const flush = (checkpoints != nullptr) ? Z_BLOCK : Z_FINISH;
+  std::int64_t total_out = 0;
   for (std::int64_t i = 0; i < data->compressed_length; i += zLib::BLOCK_SIZEi64) {
     std::size_t block_size = static_cast<std::size_t>(std::min<std::int64_t>(data->compressed_length - i, zLib::BLOCK_SIZEi64));
     if (input.Read(&input_block[0], block_size) != block_size)
@@ -330,14 +388,23 @@ bool DeflateTransform::Apply(Streams::Stream& input, Streams::Stream& output, vo
     do {
       stream.next_out = &output_block[0];
       stream.avail_out = static_cast<uInt>(zLib::BLOCK_SIZE);
-      ret = inflate(&stream, Z_FINISH);
+      ret = inflate(&stream, flush);
       std::size_t const count = zLib::BLOCK_SIZE - static_cast<std::size_t>(stream.avail_out);
       if (output.Write(&output_block[0], count) != count){
         inflateEnd(&stream);
         return false;
       }
-    } while ((stream.avail_out == 0) && (ret == Z_BUF_ERROR));
-    if ((ret != Z_BUF_ERROR) && (ret != Z_STREAM_END))
+      if (checkpoints != nullptr) {
+        std::size_t const start = static_cast<std::size_t>(total_out % static_cast<std::int64_t>(zLib::WINDOW_SIZE)), wrap = std::min<std::size_t>(count, zLib::WINDOW_SIZE - start);
+        std::memcpy(&window[start], &output_block[0], wrap);
+        std::memcpy(&window[0], &output_block[wrap], count - wrap);
+        total_out += static_cast<std::int64_t>(count);
+        // only the end of a deflate block that isn't the last one is a possible resume point
+        if (((stream.data_type & 128) != 0) && ((stream.data_type & 64) == 0) && (total_out - (checkpoints->empty() ? 0LL : checkpoints->back().output) >= zLib::CHECKPOINT_SPAN))
+          Checkpoint(*checkpoints, stream, i + static_cast<std::int64_t>(block_size - stream.avail_in), total_out);
+      }
+    } while ((ret == Z_OK) || ((stream.avail_out == 0) && (ret == Z_BUF_ERROR)));  // Z_OK means it stopped at the end of a deflate block
+    if ((ret != Z_BUF_ERROR) && (ret != Z_OK) && (ret != Z_STREAM_END))
       break;
   }
   inflateEnd(&stream);
@@ -391,4 +458,72 @@ bool DeflateTransform::Undo(Streams::Stream& input, Streams::Stream& output, voi
   }
   deflateEnd(&stream);
   return (position == length);
+}
+
+bool DeflateTransform::Resume(Streams::Stream& input, Streams::Stream& output, std::int64_t& begin, std::int64_t& end, void* info) {
+  if (info == nullptr)
+    return false;
+  Structures::DeflateInfo* data = reinterpret_cast<Structures::DeflateInfo*>(info);
+  if (data->checkpoints == nullptr) {
+    // nothing recorded yet, so have the next full inflate record resume points for next time
+    data->checkpoints = new (std::nothrow) std::vector<Structures::DeflateCheckpoint>();
+    return false;
+  }
+  std::int64_t const target = std::min<std::int64_t>(end, data->uncompressed_length);
+  if ((begin < 0) || (begin >= target))
+    return false;
+  // resume from the last point at or before the start of the range, or from the start of the stream if there's none
+  std::vector<Structures::DeflateCheckpoint> const& checkpoints = *data->checkpoints;
+  auto checkpoint = std::upper_bound(checkpoints.begin(), checkpoints.end(), begin, [](std::int64_t const offset, Structures::DeflateCheckpoint const& point) { return offset < point.output; });
+  std::int64_t const base = input.Position();
+  std::int64_t position = 0, consumed = 0;  // offsets in the uncompressed and the compressed data
+  z_stream stream;
+  zLib::SetupStream(&stream);
+  bool const resuming = (checkpoint != checkpoints.begin());
+  // past any header, it's raw deflate data
+  int ret = resuming ? inflateInit2(&stream, -MAX_WBITS) : zLib::InflateInit(&stream, data->zLib.parameters);
+  if (ret != Z_OK)
+    return false;
+  bool resumed = true;
+  if (resuming) {
+    checkpoint--;
+    consumed = checkpoint->input - ((checkpoint->bits > 0) ? 1 : 0);
+    resumed = input.Seek(base + consumed);
+    if (resumed && (checkpoint->bits > 0)) {
+      std::uint8_t byte = 0;
+      resumed = (input.Read(&byte, 1) == 1) && (inflatePrime(&stream, checkpoint->bits, byte >> (8 - checkpoint->bits)) == Z_OK);
+      consumed++;
+    }
+    resumed = resumed && (inflateSetDictionary(&stream, &checkpoint->window[0], static_cast<uInt>(zLib::WINDOW_SIZE)) == Z_OK);
+    position = checkpoint->output;
+  }
+  if ((!resumed) || !output.Seek(position)) {
+    inflateEnd(&stream);
+    return false;
+  }
+  begin = position;
+  while ((position < target) && (consumed < data->compressed_length)) {
+    std::size_t block_size = static_cast<std::size_t>(std::min<std::int64_t>(data->compressed_length - consumed, zLib::BLOCK_SIZEi64));
+    if (input.Read(&input_block[0], block_size) != block_size)
+      break;
+    consumed += static_cast<std::int64_t>(block_size);
+    stream.next_in  = &input_block[0];
+    stream.avail_in = static_cast<uInt>(block_size);
+    do {
+      stream.next_out = &output_block[0];
+      stream.avail_out = static_cast<uInt>(zLib::BLOCK_SIZE);
+      ret = inflate(&stream, Z_FINISH);
+      std::size_t const count = zLib::BLOCK_SIZE - static_cast<std::size_t>(stream.avail_out);
+      if (output.Write(&output_block[0], count) != count) {
+        inflateEnd(&stream);
+        return false;
+      }
+      position += static_cast<std::int64_t>(count);
+    } while ((stream.avail_out == 0) && (ret == Z_BUF_ERROR) && (position < target));
+    if ((ret != Z_BUF_ERROR) && (ret != Z_STREAM_END))
+      break;
+  }
+  inflateEnd(&stream);
+  end = position;
+  return (position >= target);
 }
\ No newline at end of file
@@ -32,6 +32,8 @@ namespace zLib {
   static constexpr std::size_t  POSSIBLE_COMBINATIONS = 81;
   static constexpr std::size_t  BLOCK_SIZE = 0x8000;
   static constexpr std::int64_t BLOCK_SIZEi64 = static_cast<std::int64_t>(zLib::BLOCK_SIZE);
+  static constexpr std::int64_t INFLATE_COST = 4;  // per uncompressed byte, relative to the cost of I/O
+  static constexpr std::int64_t CHECKPOINT_SPAN = 0x100000;  // minimum amount of uncompressed data between resume points
   static inline int ParseHeader(std::uint16_t const header) {
     switch (header) {
       case 0x2815: return 0;
@@ -85,12 +87,14 @@ private:
   std::array<std::int64_t, zLib::POSSIBLE_COMBINATIONS * zLib::MAX_PENALTY_BYTES> differ_positions;
   std::array<z_stream    , zLib::POSSIBLE_COMBINATIONS> recompressed_streams;
   std::array<std::int64_t, zLib::POSSIBLE_COMBINATIONS> recompressed_streams_sizes;
+  std::array<std::uint8_t, zLib::WINDOW_SIZE> window;  // circular buffer with the latest uncompressed data, for recording resume points
   struct {
     struct {
       std::array<std::uint8_t, zLib::BLOCK_SIZE> input_block;
       std::array<std::uint8_t, zLib::BLOCK_SIZE> recompressed_block;
       z_stream backup_stream;
       std::int64_t offset;  // stream offset before starting skip mode
+      std::int64_t output_position;  // position in the output stream before starting skip mode
       int main_return;
     } saved;
     std::int64_t threshold = zLib::BLOCK_SIZEi64;  // threshold of activation
@@ -104,11 +108,13 @@ private:
   bool Validate(Structures::DeflateInfo const& data);
   void ClearBuffers();
   void SetupParameters(Structures::DeflateInfo& data);
-  bool AttemptBlockRecompression(std::int64_t const base, std::int64_t const length, std::size_t const id);
+  bool AttemptBlockRecompression(std::int64_t const base, std::size_t const id);
+  void Checkpoint(std::vector<Structures::DeflateCheckpoint>& checkpoints, z_stream const& stream, std::int64_t const input, std::int64_t const output);
 public:
   Streams::HybridStream* Attempt(Streams::Stream& input, Storage::Manager& manager, void* info = nullptr);
   bool Apply(Streams::Stream& input, Streams::Stream& output, void* info = nullptr);
   bool Undo(Streams::Stream& input, Streams::Stream& output, void* info = nullptr);
+  bool Resume(Streams::Stream& input, Streams::Stream& output, std::int64_t& begin, std::int64_t& end, void* info = nullptr);
 };
 
 #endif  // DEFLATETRANSFORM_HPP
\ No newline at end of file
@@ -29,6 +29,9 @@ public:
   virtual Streams::HybridStream* Attempt(Streams::Stream& input, Storage::Manager& manager, void* info = nullptr) = 0;
   virtual bool Apply(Streams::Stream& input, Streams::Stream& output, void* info = nullptr) = 0;
   virtual bool Undo(Streams::Stream& input, Streams::Stream& output, void* info = nullptr) = 0;
+  // recreates only the part of the output between begin and end, if resuming from somewhere close to it is possible,
+  // adjusting both to the range actually written. Otherwise returns false, and the output must be recreated with Apply
+  virtual bool Resume(Streams::Stream& /*input*/, Streams::Stream& /*output*/, std::int64_t& /*begin*/, std::int64_t& /*end*/, void* /*info*/ = nullptr) { return false; }
 };
 
 #endif  // TRANSFORM_HPP
\ No newline at end of file